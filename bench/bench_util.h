@@ -0,0 +1,69 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace bench {
+
+    using Clock = std::chrono::steady_clock;
+
+    inline double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Keeps the optimizer from discarding a value we computed only to time it.
+    template <typename T>
+    inline void do_not_optimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Nearest-rank percentile over an unsorted sample set (p in [0, 100]).
+    inline double percentile(std::vector<double> samples, double p) {
+        if (samples.empty()) return 0.0;
+        std::sort(samples.begin(), samples.end());
+        size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+        return samples[std::min(rank, samples.size() - 1)];
+    }
+
+    // Writes one JSON object per line to stdout and, if given, appends it
+    // to the results file as well.
+    class Reporter {
+    public:
+        explicit Reporter(const std::string& out_path) {
+            if (!out_path.empty()) {
+                file_.open(out_path, std::ios::app);
+                if (!file_) throw std::runtime_error("Failed to open results file: " + out_path);
+            }
+        }
+
+        void emit(const json& record) {
+            std::string line = record.dump();
+            std::cout << line << std::endl;
+            if (file_) file_ << line << '\n' << std::flush;
+        }
+
+    private:
+        std::ofstream file_;
+    };
+
+    // Parses "--out <path>" style flags; returns the value or `fallback`.
+    inline std::string flag_value(int argc, char* argv[], const std::string& name, const std::string& fallback) {
+        for (int i = 1; i + 1 < argc; ++i) {
+            if (name == argv[i]) return argv[i + 1];
+        }
+        return fallback;
+    }
+
+    inline int64_t unix_time() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+} // namespace bench
@@ -0,0 +1,180 @@
+// Micro-benchmarks for the hot helpers used while loading torrents and
+// verifying pieces. Each case is auto-calibrated to run for roughly
+// --min-time seconds and reports ns/op plus throughput where it makes sense.
+#include "bench_util.h"
+#include "bencode.h"
+#include "log.h"
+#include "merkle.h"
+#include "torrent.h"
+#include "utils.h"
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <unistd.h>
+
+namespace {
+
+    struct Case {
+        std::string name;
+        size_t bytes_per_op; // 0 when throughput is meaningless
+        std::function<void()> op;
+    };
+
+    std::string random_bytes(size_t n, uint32_t seed) {
+        std::mt19937 rng(seed);
+        std::string s(n, '\0');
+        for (auto& c : s) c = static_cast<char>(rng() & 0xFF);
+        return s;
+    }
+
+    // Builds a metainfo dictionary shaped like a real large torrent:
+    // one long "pieces" string plus a multi-file list.
+    json synthetic_metainfo(int64_t num_pieces, int num_files) {
+        int64_t piece_length = 256 * 1024;
+        json files = json::array();
+        int64_t total = num_pieces * piece_length;
+        for (int i = 0; i < num_files; ++i) {
+            int64_t len = total / num_files + (i == 0 ? total % num_files : 0);
+            files.push_back(json{
+                {"length", len},
+                {"path", json::array({"dir" + std::to_string(i % 16), "file" + std::to_string(i) + ".bin"})}});
+        }
+        json info{
+            {"name", "synthetic"},
+            {"piece length", piece_length},
+            {"pieces", random_bytes(num_pieces * 20, 7)},
+            {"files", files}};
+        return json{{"announce", "http://127.0.0.1:6969/announce"}, {"info", info}};
+    }
+
+    json run_case(const Case& c, double min_time) {
+        // Warm up and calibrate: double the batch until it takes >= 10ms.
+        uint64_t batch = 1;
+        for (;;) {
+            auto start = bench::Clock::now();
+            for (uint64_t i = 0; i < batch; ++i) c.op();
+            if (bench::seconds_since(start) >= 0.01 || batch >= (1ull << 30)) break;
+            batch *= 2;
+        }
+
+        std::vector<double> batch_ns;
+        uint64_t total_ops = 0;
+        auto begin = bench::Clock::now();
+        while (bench::seconds_since(begin) < min_time || batch_ns.size() < 5) {
+            auto start = bench::Clock::now();
+            for (uint64_t i = 0; i < batch; ++i) c.op();
+            batch_ns.push_back(bench::seconds_since(start) * 1e9 / batch);
+            total_ops += batch;
+        }
+        double elapsed = bench::seconds_since(begin);
+        double ns_per_op = elapsed * 1e9 / total_ops;
+
+        json r{
+            {"suite", "micro"},
+            {"name", c.name},
+            {"ops", total_ops},
+            {"ns_per_op", ns_per_op},
+            {"p50_ns", bench::percentile(batch_ns, 50)},
+            {"p99_ns", bench::percentile(batch_ns, 99)},
+            {"timestamp", bench::unix_time()}};
+        if (c.bytes_per_op) {
+            r["bytes_per_op"] = c.bytes_per_op;
+            r["mb_per_s"] = c.bytes_per_op / (ns_per_op / 1e9) / (1024.0 * 1024.0);
+        }
+        return r;
+    }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string out_path = bench::flag_value(argc, argv, "--out", "");
+    std::string filter = bench::flag_value(argc, argv, "--filter", "");
+    double min_time = std::stod(bench::flag_value(argc, argv, "--min-time", "0.5"));
+    bench::Reporter reporter(out_path);
+
+    std::vector<Case> cases;
+
+    // --- bencode ---
+    for (int64_t pieces : {1000, 100000}) {
+        json meta = synthetic_metainfo(pieces, 64);
+        auto encoded = std::make_shared<std::string>(bencode::encode(meta));
+        cases.push_back({"bencode_decode/pieces=" + std::to_string(pieces), encoded->size(),
+                         [encoded] { bench::do_not_optimize(bencode::decode(*encoded)); }});
+        auto meta_ptr = std::make_shared<json>(meta);
+        cases.push_back({"bencode_encode/pieces=" + std::to_string(pieces), encoded->size(),
+                         [meta_ptr] { bench::do_not_optimize(bencode::encode(*meta_ptr)); }});
+    }
+    {
+        json list = json::array();
+        for (int i = 0; i < 10000; ++i) list.push_back(json{{"k", i}, {"v", "value" + std::to_string(i)}});
+        auto encoded = std::make_shared<std::string>(bencode::encode(list));
+        cases.push_back({"bencode_decode/small_dicts=10000", encoded->size(),
+                         [encoded] { bench::do_not_optimize(bencode::decode(*encoded)); }});
+    }
+
+    // --- sha1 ---
+    for (size_t size : {size_t(16 * 1024), size_t(256 * 1024), size_t(4 * 1024 * 1024)}) {
+        auto data = std::make_shared<std::string>(random_bytes(size, 11));
+        cases.push_back({"sha1_hash/bytes=" + std::to_string(size), size,
+                         [data] { bench::do_not_optimize(utils::sha1_hash(*data)); }});
+    }
+
+    // --- v2 merkle ---
+    for (size_t size : {size_t(256 * 1024), size_t(4 * 1024 * 1024)}) {
+        auto data = std::make_shared<std::string>(random_bytes(size, 17));
+        cases.push_back({"merkle_piece/bytes=" + std::to_string(size), size, [data] {
+                             std::string leaves;
+                             for (size_t pos = 0; pos < data->size(); pos += merkle::LEAF_SIZE)
+                                 leaves += merkle::hash_leaf(data->data() + pos, merkle::LEAF_SIZE);
+                             bench::do_not_optimize(merkle::root(leaves, data->size() / merkle::LEAF_SIZE));
+                         }});
+    }
+
+    // --- to_hex ---
+    for (size_t size : {size_t(20), size_t(4096)}) {
+        auto data = std::make_shared<std::string>(random_bytes(size, 13));
+        cases.push_back({"to_hex/bytes=" + std::to_string(size), size, [data] {
+                             bench::do_not_optimize(utils::to_hex(
+                                 reinterpret_cast<const unsigned char*>(data->data()), data->size()));
+                         }});
+    }
+
+    // --- load_from_file ---
+    std::vector<std::string> temp_files;
+    for (int64_t pieces : {1000, 100000, 1000000}) {
+        char path[] = "/tmp/bench_torrent_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) throw std::runtime_error("mkstemp failed");
+        close(fd);
+        std::ofstream(path, std::ios::binary) << bencode::encode(synthetic_metainfo(pieces, 256));
+        temp_files.push_back(path);
+        std::string p = path;
+        size_t size = utils::read_file_as_binary_string(p).size();
+        cases.push_back({"load_from_file/pieces=" + std::to_string(pieces), size, [p] {
+                             bench::do_not_optimize(torrent::load_from_file(p).info.num_pieces);
+                         }});
+    }
+
+    // --- logging ---
+    // Per-block call sites: a statement filtered out at run time, and one
+    // that is enabled but held back by its rate limiter. Kept last:
+    // log/rate_limited leaves debug logging on, which would make every
+    // later case format and queue its debug records too.
+    logging::init(logging::Config{logging::Level::Warn, "/dev/null", false});
+    cases.push_back({"log/disabled", 0, [] {
+                         logging::set_level(logging::Level::Warn);
+                         BT_LOG_DEBUG("bench", "block " << 1 << "/" << 16384);
+                     }});
+    cases.push_back({"log/rate_limited", 0, [] {
+                         logging::set_level(logging::Level::Debug);
+                         BT_LOG_RATE_LIMITED(logging::Level::Debug, 10, "bench", "block " << 1 << "/" << 16384);
+                     }});
+
+    for (const auto& c : cases) {
+        if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+        reporter.emit(run_case(c, min_time));
+    }
+
+    for (const auto& p : temp_files) std::remove(p.c_str());
+    return 0;
+}
@@ -0,0 +1,360 @@
+#include "mock_swarm.h"
+#include "bencode.h"
+#include "merkle.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bench {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Helper: open a listening TCP socket on 127.0.0.1 with an ephemeral port.
+    static int listen_loopback(uint16_t& port_out) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("Failed to create socket");
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+            close(fd);
+            throw std::runtime_error("Failed to bind loopback listener");
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (sockaddr*)&addr, &len);
+        port_out = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    static bool send_all(int fd, const void* data, size_t len) {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    static bool recv_all(int fd, void* data, size_t len) {
+        return len == 0 || recv(fd, data, len, MSG_WAITALL) == (ssize_t)len;
+    }
+
+    static bool send_frame(int fd, uint8_t id, const std::string& payload = {}) {
+        std::string frame(5, '\0');
+        uint32_t len_n = htonl(payload.size() + 1);
+        std::memcpy(frame.data(), &len_n, 4);
+        frame[4] = static_cast<char>(id);
+        frame += payload;
+        return send_all(fd, frame.data(), frame.size());
+    }
+
+    MockSwarm::MockSwarm(std::string payload, int64_t piece_length, const SwarmConfig& config)
+        : payload_(std::move(payload)),
+          piece_length_(piece_length),
+          num_pieces_((payload_.size() + piece_length - 1) / piece_length),
+          config_(config) {
+        json info{
+            {"name", "mock_payload.bin"},
+            {"piece length", piece_length_}};
+        if (config_.format != torrent::Format::V2) {
+            std::string pieces;
+            for (int64_t i = 0; i < num_pieces_; ++i) {
+                pieces += utils::sha1_hash(payload_.substr(i * piece_length_, piece_length_));
+            }
+            info["length"] = static_cast<int64_t>(payload_.size());
+            info["pieces"] = pieces;
+        }
+        if (config_.format != torrent::Format::V1) {
+            // One file, so the piece layer is a slice of the leaf layer's tree.
+            for (size_t pos = 0; pos < payload_.size(); pos += merkle::LEAF_SIZE)
+                leaves_ += merkle::hash_leaf(payload_.data() + pos, std::min<size_t>(merkle::LEAF_SIZE, payload_.size() - pos));
+            int64_t leaves_per_piece = piece_length_ / merkle::LEAF_SIZE;
+            int64_t num_leaves = leaves_.size() / merkle::HASH_SIZE;
+            if (num_pieces_ == 1) {
+                pieces_root_ = merkle::root(leaves_, merkle::next_pow2(num_leaves));
+            } else {
+                std::string layer;
+                for (int64_t first = 0; first < num_leaves; first += leaves_per_piece) {
+                    int64_t n = std::min(leaves_per_piece, num_leaves - first);
+                    layer += merkle::root(leaves_.substr(first * merkle::HASH_SIZE, n * merkle::HASH_SIZE), leaves_per_piece);
+                }
+                pieces_root_ = merkle::root(layer, merkle::next_pow2(num_pieces_), merkle::pad_hash(leaves_per_piece));
+                piece_layers_ = bencode::encode(json{{pieces_root_, layer}});
+            }
+            info["meta version"] = 2;
+            info["file tree"] = json{{"mock_payload.bin", {{"", {{"length", static_cast<int64_t>(payload_.size())},
+                                                                  {"pieces root", pieces_root_}}}}}};
+        }
+        info_bencoded_ = bencode::encode(info);
+
+        tracker_fd_ = listen_loopback(tracker_port_);
+        for (int i = 0; i < config_.num_seeders; ++i) {
+            uint16_t port;
+            seeder_fds_.push_back(listen_loopback(port));
+            seeder_ports_.push_back(port);
+        }
+
+        spawn(std::thread(&MockSwarm::tracker_loop, this));
+        for (int fd : seeder_fds_) spawn(std::thread(&MockSwarm::seeder_loop, this, fd));
+    }
+
+    MockSwarm::~MockSwarm() {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            // shutdown() wakes any thread blocked in accept()/recv() on these fds.
+            shutdown(tracker_fd_, SHUT_RDWR);
+            for (int fd : seeder_fds_) shutdown(fd, SHUT_RDWR);
+            for (int fd : open_fds_) shutdown(fd, SHUT_RDWR);
+            threads.swap(threads_);
+        }
+        for (auto& t : threads) t.join();
+        // Connection threads may have been spawned while we were joining.
+        for (auto& t : threads_) t.join();
+        close(tracker_fd_);
+        for (int fd : seeder_fds_) close(fd);
+    }
+
+    void MockSwarm::spawn(std::thread t) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.push_back(std::move(t));
+    }
+
+    void MockSwarm::write_torrent(const std::string& path) const {
+        std::string announce = "http://127.0.0.1:" + std::to_string(tracker_port_) + "/announce";
+        std::string meta = "d8:announce" + std::to_string(announce.size()) + ":" + announce
+                         + "4:info" + info_bencoded_;
+        if (!piece_layers_.empty()) meta += "12:piece layers" + piece_layers_;
+        meta += "e";
+        std::ofstream ofs(path, std::ios::binary);
+        if (!ofs) throw std::runtime_error("Failed to write torrent: " + path);
+        ofs << meta;
+    }
+
+    void MockSwarm::tracker_loop() {
+        std::string peers;
+        for (uint16_t port : seeder_ports_) {
+            uint32_t ip_n = htonl(INADDR_LOOPBACK);
+            uint16_t port_n = htons(port);
+            peers.append(reinterpret_cast<const char*>(&ip_n), 4);
+            peers.append(reinterpret_cast<const char*>(&port_n), 2);
+        }
+        std::string body = bencode::encode(json{{"interval", 60}, {"peers", peers}});
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: "
+                             + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+        while (!stopping_) {
+            int fd = accept(tracker_fd_, nullptr, nullptr);
+            if (fd < 0) break;
+            std::string request;
+            char buf[1024];
+            while (request.find("\r\n\r\n") == std::string::npos) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) break;
+                request.append(buf, n);
+            }
+            if (config_.tracker_latency_ms > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(config_.tracker_latency_ms));
+            send_all(fd, response.data(), response.size());
+            close(fd);
+        }
+    }
+
+    void MockSwarm::seeder_loop(int listen_fd) {
+        while (!stopping_) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) break;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                open_fds_.push_back(fd);
+                if (stopping_) shutdown(fd, SHUT_RDWR);
+            }
+            spawn(std::thread(&MockSwarm::serve_peer, this, fd));
+        }
+    }
+
+    // Reply to a hash request (id=21): the requested leaf hashes (id=22),
+    // zero-padded past the end of the file, or a reject (id=23).
+    std::pair<uint8_t, std::string> MockSwarm::answer_hash_request(const std::string& request) const {
+        auto field = [&](size_t at) {
+            uint32_t v;
+            std::memcpy(&v, request.data() + at, 4);
+            return static_cast<int64_t>(ntohl(v));
+        };
+        int64_t padded = merkle::next_pow2(leaves_.size() / merkle::HASH_SIZE);
+        int64_t index = field(36), length = field(40);
+        if (pieces_root_.empty() || request.compare(0, merkle::HASH_SIZE, pieces_root_) != 0 || field(32) != 0 ||
+            field(44) != 0 || length <= 0 || index + length > padded)
+            return {23, request};
+        std::string hashes = leaves_.substr(std::min<size_t>(index * merkle::HASH_SIZE, leaves_.size()),
+                                            length * merkle::HASH_SIZE);
+        hashes.resize(length * merkle::HASH_SIZE, '\0');
+        return {22, request + hashes};
+    }
+
+    std::vector<double> MockSwarm::take_block_latencies_us() {
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        return std::exchange(block_latencies_us_, {});
+    }
+
+    // One connection: a reader thread queues requests with their due time
+    // (arrival + latency) and this thread answers them in order, pacing
+    // blocks to the configured bandwidth and injecting chokes.
+    void MockSwarm::serve_peer(int fd) {
+        struct Request {
+            uint32_t index, begin, length;
+            Clock::time_point received;
+            Clock::time_point due;
+            uint8_t reply_id = 7;
+            std::string reply; // prepared answer for anything but a block request
+        };
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<Request> queue;
+        bool interested = false;
+        bool choked = false; // block requests are dropped while set, as real peers do
+        bool closed = false;
+
+        auto release = [&] {
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_fds_.erase(std::remove(open_fds_.begin(), open_fds_.end(), fd), open_fds_.end());
+            close(fd);
+        };
+
+        char hs[68];
+        if (!recv_all(fd, hs, 68)) {
+            release();
+            return;
+        }
+        // Echo the info hash back with our own peer id.
+        std::memcpy(hs + 48, "-MOCK00-000000000000", 20);
+        std::string bitfield((num_pieces_ + 7) / 8, '\0');
+        for (int64_t i = 0; i < num_pieces_; ++i) bitfield[i / 8] |= static_cast<char>(0x80 >> (i % 8));
+        if (!send_all(fd, hs, 68) || !send_frame(fd, 5, bitfield)) {
+            release();
+            return;
+        }
+
+        std::thread reader([&] {
+            for (;;) {
+                uint32_t len_n;
+                if (!recv_all(fd, &len_n, 4)) break;
+                uint32_t len = ntohl(len_n);
+                if (len == 0) continue; // keep-alive
+                std::string msg(len, '\0');
+                if (!recv_all(fd, msg.data(), len)) break;
+                std::lock_guard<std::mutex> lock(m);
+                if (msg[0] == 2) {
+                    interested = true;
+                } else if (msg[0] == 6 && len == 13 && !choked) {
+                    uint32_t f[3];
+                    std::memcpy(f, msg.data() + 1, 12);
+                    auto now = Clock::now();
+                    queue.push_back({ntohl(f[0]), ntohl(f[1]), ntohl(f[2]), now,
+                                     now + std::chrono::milliseconds(config_.seeder.latency_ms), 7, {}});
+                } else if (msg[0] == 21 && len == 49) {
+                    auto now = Clock::now();
+                    Request r{0, 0, 0, now, now + std::chrono::milliseconds(config_.seeder.latency_ms), 0, {}};
+                    std::tie(r.reply_id, r.reply) = answer_hash_request(msg.substr(1));
+                    queue.push_back(std::move(r));
+                }
+                cv.notify_one();
+            }
+            std::lock_guard<std::mutex> lock(m);
+            closed = true;
+            cv.notify_one();
+        });
+
+        const SeederConfig& sc = config_.seeder;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return interested || closed; });
+        }
+        if (sc.unchoke_delay_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(sc.unchoke_delay_ms));
+        bool ok = send_frame(fd, 1);
+
+        auto start = Clock::now();
+        uint64_t bytes_sent = 0;
+        uint64_t blocks_sent = 0;
+        while (ok) {
+            Request r;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return !queue.empty() || closed; });
+                if (queue.empty()) break;
+                r = queue.front();
+                queue.pop_front();
+            }
+            std::this_thread::sleep_until(r.due);
+            if (r.reply_id != 7) {
+                ok = send_frame(fd, r.reply_id, r.reply);
+                continue;
+            }
+            if (sc.bandwidth_bytes_per_s > 0) {
+                auto allowed_at = start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(bytes_sent / sc.bandwidth_bytes_per_s));
+                std::this_thread::sleep_until(allowed_at);
+            }
+
+            uint64_t offset = uint64_t(r.index) * piece_length_ + r.begin;
+            if (offset >= payload_.size()) break;
+            std::string block(8, '\0');
+            uint32_t idx_n = htonl(r.index), begin_n = htonl(r.begin);
+            std::memcpy(block.data(), &idx_n, 4);
+            std::memcpy(block.data() + 4, &begin_n, 4);
+            block.append(payload_, offset, std::min<uint64_t>(r.length, payload_.size() - offset));
+            ++blocks_sent;
+            if (sc.corrupt_every_blocks > 0 && blocks_sent % sc.corrupt_every_blocks == 0) block.back() ^= 0x5a;
+            ok = send_frame(fd, 7, block);
+            bytes_sent += block.size() + 5;
+            if (ok) {
+                double us = std::chrono::duration<double, std::micro>(Clock::now() - r.received).count();
+                std::lock_guard<std::mutex> lock(latency_mutex_);
+                block_latencies_us_.push_back(us);
+            }
+
+            // Periodic choke. Like a real peer we discard the pending block
+            // requests and any that arrive while choked, so the client has
+            // to request them again after the unchoke.
+            if (ok && sc.choke_every_blocks > 0 && blocks_sent % sc.choke_every_blocks == 0) {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    choked = true;
+                    std::erase_if(queue, [](const Request& q) { return q.reply_id == 7; });
+                }
+                ok = send_frame(fd, 0);
+                std::this_thread::sleep_for(std::chrono::milliseconds(sc.choke_duration_ms));
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    choked = false;
+                }
+                ok = ok && send_frame(fd, 1);
+            }
+        }
+
+        shutdown(fd, SHUT_RDWR);
+        reader.join();
+        release();
+    }
+
+} // namespace bench
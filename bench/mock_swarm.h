@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "torrent_creator.h"
+
+namespace bench {
+
+    // Behavior of every seeder in the swarm.
+    struct SeederConfig {
+        int latency_ms = 0;             // delay between receiving a request and sending its block
+        double bandwidth_bytes_per_s = 0; // per-connection upload cap, 0 = unlimited
+        int unchoke_delay_ms = 0;       // delay between "interested" and the first unchoke
+        int choke_every_blocks = 0;     // choke after this many blocks, 0 = never
+        int choke_duration_ms = 0;      // how long each periodic choke lasts
+        int corrupt_every_blocks = 0;   // flip a byte in every Nth block sent, 0 = never
+    };
+
+    struct SwarmConfig {
+        int num_seeders = 1;
+        int tracker_latency_ms = 0;
+        torrent::Format format = torrent::Format::V1; // v2/hybrid seeders also answer hash requests
+        SeederConfig seeder;
+    };
+
+    // An in-process HTTP tracker plus N peer-wire seeders, all bound to
+    // 127.0.0.1 on ephemeral ports. Every seeder holds the complete payload.
+    class MockSwarm {
+    public:
+        MockSwarm(std::string payload, int64_t piece_length, const SwarmConfig& config);
+        ~MockSwarm();
+
+        MockSwarm(const MockSwarm&) = delete;
+        MockSwarm& operator=(const MockSwarm&) = delete;
+
+        // Writes a .torrent file whose announce URL points at the mock tracker.
+        void write_torrent(const std::string& path) const;
+
+        const std::string& payload() const { return payload_; }
+
+        // Per-block request latency (request received to block sent, in
+        // microseconds) of every block served since the last call.
+        std::vector<double> take_block_latencies_us();
+
+    private:
+        void tracker_loop();
+        void seeder_loop(int listen_fd);
+        void serve_peer(int fd);
+        std::pair<uint8_t, std::string> answer_hash_request(const std::string& request) const;
+        void spawn(std::thread t);
+
+        std::string payload_;
+        int64_t piece_length_;
+        int64_t num_pieces_;
+        SwarmConfig config_;
+        std::string info_bencoded_;
+        std::string pieces_root_;   // v2 only
+        std::string leaves_;        // v2 leaf hashes of the payload
+        std::string piece_layers_;  // bencoded "piece layers", empty when not needed
+
+        int tracker_fd_ = -1;
+        uint16_t tracker_port_ = 0;
+        std::vector<int> seeder_fds_;
+        std::vector<uint16_t> seeder_ports_;
+
+        std::atomic<bool> stopping_{false};
+        std::mutex mutex_; // guards threads_ and open_fds_
+        std::vector<std::thread> threads_;
+        std::vector<int> open_fds_;
+
+        std::mutex latency_mutex_;
+        std::vector<double> block_latencies_us_;
+    };
+
+} // namespace bench
@@ -2,7 +2,7 @@
 #define BENCODE_H
 
 #include <string>
-#include "../lib/nlohmann/json.hpp" // Adjust path as needed
+#include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
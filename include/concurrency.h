@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool. Tasks run in submission order; the destructor
+// finishes everything already queued before joining.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void post(std::function<void()> task);
+
+    size_t queued() const;
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    void worker_loop();
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+// Runs `task` on `pool`, or inline when there is no pool.
+inline void run_on(ThreadPool* pool, std::function<void()> task) {
+    if (pool) pool->post(std::move(task));
+    else task();
+}
+
+// Counting limit on a shared resource (connections, buffered bytes).
+// acquire() blocks until `amount` units are free. A request larger than
+// the whole limit is clamped so it can still proceed alone.
+class ResourceLimit {
+public:
+    explicit ResourceLimit(int64_t capacity) : capacity_(capacity), available_(capacity) {}
+
+    void acquire(int64_t amount);
+    // Takes `amount` only if it is free right now.
+    bool try_acquire(int64_t amount);
+    void release(int64_t amount);
+
+    int64_t capacity() const { return capacity_; }
+    int64_t in_use() const;
+
+    // RAII hold on `amount` units of `limit` (no-op when `limit` is null).
+    class Lease {
+    public:
+        Lease(ResourceLimit* limit, int64_t amount);
+        // Adopts units already taken with try_acquire().
+        Lease(ResourceLimit* limit, int64_t amount, std::adopt_lock_t) : limit_(limit), amount_(amount) {}
+        ~Lease();
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+    private:
+        ResourceLimit* limit_;
+        int64_t amount_;
+    };
+
+private:
+    int64_t clamp(int64_t amount) const { return amount < capacity_ ? amount : capacity_; }
+
+    const int64_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    int64_t available_;
+};
+
+// Cancellation flag that also interrupts blocking socket I/O: cancel()
+// shuts down every socket being watched, so a session stuck in recv() or
+// send() fails right away instead of at its next check of the flag.
+class CancelToken {
+public:
+    void cancel();
+    bool cancelled() const { return cancelled_.load(); }
+
+    // Watches `fd` while in scope (no-op when `token` is null). Must be
+    // destroyed before `fd` is closed.
+    class Watch {
+    public:
+        Watch(CancelToken* token, int fd);
+        ~Watch();
+        Watch(const Watch&) = delete;
+        Watch& operator=(const Watch&) = delete;
+
+    private:
+        CancelToken* token_;
+        int fd_;
+    };
+
+private:
+    std::atomic<bool> cancelled_{false};
+    std::mutex mutex_;
+    std::set<int> fds_;
+};
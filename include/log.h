@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Asynchronous leveled logging.
+//
+//   BT_LOG_INFO("tracker", peers.size() << " peers from " << url);
+//
+// The message is formatted on the calling thread only when its level is
+// enabled, then pushed onto that thread's own lock-free queue; a single
+// background writer drains every queue and does all the I/O, so logging
+// never takes a lock or makes a syscall on the caller's path. A full
+// queue drops the record (the writer reports how many) rather than block.
+//
+// Statements below BITTORRENT_LOG_MIN_LEVEL are compiled out: their
+// arguments are never evaluated. The rest are filtered at run time by the
+// level from the environment, read by config_from_env():
+//   BITTORRENT_LOG=trace|debug|info|warn|error|off   (default warn)
+//   BITTORRENT_LOG_FILE=<path>                        (default stderr)
+//   BITTORRENT_LOG_FORMAT=text|json                   (default text)
+#ifndef BITTORRENT_LOG_MIN_LEVEL
+#define BITTORRENT_LOG_MIN_LEVEL 0
+#endif
+
+namespace logging {
+
+    enum class Level : int { Trace = 0, Debug, Info, Warn, Error, Off };
+
+    struct Config {
+        Level level = Level::Warn;
+        std::string path; // empty = stderr
+        bool json = false;
+    };
+
+    Config config_from_env();
+
+    // Starts the background writer; until then records are written
+    // synchronously to stderr. Registers shutdown() to run at exit.
+    void init(const Config& config);
+
+    // Writes everything queued so far and stops the writer.
+    void shutdown();
+
+    // Returns once every record queued before the call has been written.
+    void flush();
+
+    extern std::atomic<int> g_level;
+
+    inline void set_level(Level level) { g_level.store(static_cast<int>(level), std::memory_order_relaxed); }
+
+    inline bool enabled(Level level) {
+        return static_cast<int>(level) >= g_level.load(std::memory_order_relaxed);
+    }
+
+    // `component` must be a string literal (it is stored by pointer).
+    void write(Level level, const char* component, std::string message);
+
+    // Lock-free token bucket for call sites that fire per block or per
+    // message: lets through `per_second` records a second (bursts of the
+    // same size) and counts the rest.
+    class RateLimiter {
+    public:
+        explicit RateLimiter(double per_second);
+
+        // True when this event may be logged; `suppressed` is set to the
+        // number dropped since the last one that was.
+        bool allow(uint64_t& suppressed);
+
+    private:
+        const int64_t interval_ns_;
+        const int64_t burst_ns_;
+        std::atomic<int64_t> next_ns_{0}; // theoretical arrival time of the next event
+        std::atomic<uint64_t> suppressed_{0};
+    };
+
+} // namespace logging
+
+#define BT_LOG(level, component, expr)                                                  \
+    do {                                                                                \
+        if constexpr (static_cast<int>(level) >= BITTORRENT_LOG_MIN_LEVEL) {            \
+            if (::logging::enabled(level)) {                                            \
+                std::ostringstream bt_log_out_;                                         \
+                bt_log_out_ << expr;                                                    \
+                ::logging::write(level, component, bt_log_out_.str());                  \
+            }                                                                           \
+        }                                                                               \
+    } while (0)
+
+// At most `per_second` records a second from this call site; the next one
+// let through says how many were suppressed in between.
+#define BT_LOG_RATE_LIMITED(level, per_second, component, expr)                         \
+    do {                                                                                \
+        if constexpr (static_cast<int>(level) >= BITTORRENT_LOG_MIN_LEVEL) {            \
+            if (::logging::enabled(level)) {                                            \
+                static ::logging::RateLimiter bt_log_limiter_(per_second);              \
+                uint64_t bt_log_suppressed_;                                            \
+                if (bt_log_limiter_.allow(bt_log_suppressed_)) {                        \
+                    std::ostringstream bt_log_out_;                                     \
+                    bt_log_out_ << expr;                                                \
+                    if (bt_log_suppressed_)                                             \
+                        bt_log_out_ << " (" << bt_log_suppressed_ << " similar suppressed)"; \
+                    ::logging::write(level, component, bt_log_out_.str());              \
+                }                                                                       \
+            }                                                                           \
+        }                                                                               \
+    } while (0)
+
+#define BT_LOG_TRACE(component, expr) BT_LOG(::logging::Level::Trace, component, expr)
+#define BT_LOG_DEBUG(component, expr) BT_LOG(::logging::Level::Debug, component, expr)
+#define BT_LOG_INFO(component, expr) BT_LOG(::logging::Level::Info, component, expr)
+#define BT_LOG_WARN(component, expr) BT_LOG(::logging::Level::Warn, component, expr)
+#define BT_LOG_ERROR(component, expr) BT_LOG(::logging::Level::Error, component, expr)
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// SHA-256 Merkle trees as used by BitTorrent v2 (BEP 52).
+//
+// Leaves are the SHA-256 of each 16 KiB block of a file (the last block may
+// be short). A tree over n leaves is padded with zero hashes up to the next
+// power of two, so the node above a run of padding is the root of an
+// all-zero subtree. Hashes are passed around as strings of concatenated
+// 32-byte nodes.
+namespace merkle {
+
+    constexpr int64_t LEAF_SIZE = 16 * 1024;
+    constexpr size_t HASH_SIZE = 32;
+
+    // Smallest power of two >= n (1 for n <= 1).
+    int64_t next_pow2(int64_t n);
+
+    // Number of leaves under a file of `length` bytes.
+    int64_t num_leaves(int64_t length);
+
+    // Leaf hash of one block.
+    std::string hash_leaf(const void* data, size_t len);
+
+    // Root of an all-zero subtree with `width` leaves (a power of two).
+    std::string pad_hash(int64_t width);
+
+    // Root of a tree whose bottom layer is `nodes` padded with `pad` up to
+    // `width` entries. `width` must be a power of two >= the node count.
+    std::string root(const std::string& nodes, int64_t width, const std::string& pad = std::string(HASH_SIZE, '\0'));
+
+} // namespace merkle
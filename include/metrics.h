@@ -0,0 +1,133 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Process-wide download counters and latency histograms.
+// Every update is a relaxed atomic add, so the hot path never takes a lock;
+// readers take a snapshot that is consistent per field, not across fields.
+namespace metrics {
+
+    using Clock = std::chrono::steady_clock;
+
+    inline uint64_t micros_since(Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    }
+
+    // Histogram with power-of-two buckets: bucket i counts values in
+    // [2^(i-1), 2^i), bucket 0 counts zeros. Values are microseconds.
+    class Histogram {
+    public:
+        static constexpr int NUM_BUCKETS = 40;
+
+        void record(uint64_t value);
+
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+        // Upper bound of the bucket holding the p-th percentile (p in [0, 100]).
+        uint64_t percentile(double p) const;
+
+        json to_json() const;
+        void write_prometheus(std::string& out, const std::string& name, const std::string& labels = "") const;
+
+    private:
+        std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets_{};
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> sum_{0};
+    };
+
+    // Counters for a single remote peer, keyed by "ip:port".
+    struct PeerStats {
+        explicit PeerStats(std::string addr) : address(std::move(addr)) {}
+
+        const std::string address;
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<uint64_t> blocks_received{0};
+        std::atomic<uint64_t> blocks_failed{0}; // v2 blocks that did not match their leaf hash
+        std::atomic<uint64_t> choked_us{0};
+        Histogram request_rtt_us;
+
+        json to_json() const;
+    };
+
+    struct Registry {
+        // Totals across all peers.
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<int64_t> blocks_in_flight{0};
+        std::atomic<uint64_t> pieces_verified{0};
+        std::atomic<uint64_t> pieces_failed{0};
+        std::atomic<uint64_t> blocks_failed{0};
+        std::atomic<uint64_t> choked_us{0};
+        std::atomic<int64_t> disk_queue_depth{0};
+
+        // Progress of the current download(s).
+        std::atomic<uint64_t> bytes_total{0};
+        std::atomic<uint64_t> bytes_received{0}; // block data, checked or not
+        std::atomic<uint64_t> bytes_verified{0}; // pieces that passed their hash check
+
+        Histogram request_rtt_us;
+        Histogram hash_us;
+        Histogram disk_write_us;
+        Histogram tracker_announce_us;
+
+        // Returns the stats object for `address`, creating it on first use.
+        // Callers keep the pointer for the life of the connection; the
+        // entry is dropped once every connection to the peer has released it.
+        std::shared_ptr<PeerStats> peer(const std::string& address);
+
+        json snapshot() const;
+        std::string prometheus() const;
+
+    private:
+        // Live peers, in address order. Callers hold peers_mutex_.
+        std::vector<std::shared_ptr<PeerStats>> live_peers() const;
+
+        mutable std::mutex peers_mutex_;
+        mutable std::map<std::string, std::weak_ptr<PeerStats>> peers_;
+        size_t peers_swept_ = 0; // map size after the last sweep of expired entries
+    };
+
+    Registry& global();
+
+    // Appends one JSON snapshot line to `path`.
+    void append_json_line(const std::string& path);
+
+    // Rewrites `path` with the Prometheus text exposition format
+    // (written to a temp file and renamed so scrapers never see half a file).
+    void write_prometheus_file(const std::string& path);
+
+    // Calls `sink` every `interval` on a background thread, and once more
+    // on destruction so the final state is always reported.
+    class Reporter {
+    public:
+        Reporter(std::chrono::milliseconds interval, std::function<void()> sink);
+        ~Reporter();
+
+        Reporter(const Reporter&) = delete;
+        Reporter& operator=(const Reporter&) = delete;
+
+    private:
+        std::chrono::milliseconds interval_;
+        std::function<void()> sink_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+        std::thread thread_;
+    };
+
+} // namespace metrics
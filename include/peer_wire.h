@@ -0,0 +1,100 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+#include "trace.h"
+
+// Frame-level view of one peer connection (after the handshake).
+// The download session talks to a Connection so the same logic can run
+// over a live socket or over a recorded trace.
+namespace wire {
+
+    class Connection {
+    public:
+        explicit Connection(std::shared_ptr<metrics::PeerStats> stats) : stats_(std::move(stats)) {}
+        virtual ~Connection() = default;
+
+        // Sends <len><id><payload>.
+        virtual void send(uint8_t id, const std::vector<uint8_t>& payload = {}) = 0;
+
+        // Blocks until the next message arrives; returns its payload and sets `id`.
+        virtual std::vector<uint8_t> recv(uint8_t& id) = 0;
+
+        metrics::PeerStats& stats() { return *stats_; }
+
+    protected:
+        void count_out(uint64_t wire_bytes);
+        void count_in(uint64_t wire_bytes);
+
+        std::shared_ptr<metrics::PeerStats> stats_;
+    };
+
+    // A connected, handshaken TCP socket. Owns the fd. When `trace` is set
+    // every frame is recorded under a fresh connection id.
+    class SocketConnection : public Connection {
+    public:
+        SocketConnection(int sock, std::shared_ptr<metrics::PeerStats> stats, trace::Writer* trace = nullptr);
+        ~SocketConnection() override;
+
+        SocketConnection(const SocketConnection&) = delete;
+        SocketConnection& operator=(const SocketConnection&) = delete;
+
+        void send(uint8_t id, const std::vector<uint8_t>& payload = {}) override;
+        std::vector<uint8_t> recv(uint8_t& id) override;
+
+        int fd() const { return sock_; }
+
+    private:
+        int sock_;
+        trace::Writer* trace_;
+        uint32_t conn_id_ = 0;
+    };
+
+    // Plays back the inbound side of one recorded connection.
+    //
+    // Control messages (bitfield, choke, unchoke, have, ...) arrive at their
+    // recorded offset from the start of the connection. Blocks are served
+    // only when requested, after the round-trip time observed for that block
+    // in the trace, so a different request order or pipeline depth is
+    // replayed against the peer's real per-block latency.
+    // `speed` scales all delays (2.0 = twice as fast); 0 disables waiting.
+    // `t` must outlive the connection.
+    class ReplayConnection : public Connection {
+    public:
+        ReplayConnection(const trace::Trace& t, uint32_t conn_id, double speed,
+                         std::shared_ptr<metrics::PeerStats> stats);
+
+        void send(uint8_t id, const std::vector<uint8_t>& payload = {}) override;
+        std::vector<uint8_t> recv(uint8_t& id) override;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct RecordedBlock {
+            const trace::Record* reply;
+            uint64_t latency_us;
+        };
+        struct Pending {
+            Clock::time_point due;
+            const trace::Record* reply;
+        };
+
+        Clock::time_point scaled(Clock::time_point base, uint64_t us) const;
+        std::vector<uint8_t> materialize(const trace::Record& r) const;
+
+        double speed_;
+        bool payloads_;
+        uint64_t open_t_us_ = 0;
+        Clock::time_point start_;
+        std::deque<const trace::Record*> control_;
+        std::map<std::pair<uint32_t, uint32_t>, RecordedBlock> blocks_;
+        std::deque<Pending> pending_;
+    };
+
+} // namespace wire
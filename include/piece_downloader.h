@@ -1,14 +1,74 @@
 #pragma once
+#include <atomic>
 #include <string>
 #include <cstdint>
+#include "torrent.h"
+
+class ThreadPool;
+class ResourceLimit;
+class CancelToken;
+
+struct DownloadOptions {
+    // When non-empty, every peer-wire frame is recorded to this file (see trace.h).
+    std::string trace_path;
+    // Keep block data in the trace. Without it a replay cannot verify piece hashes.
+    bool trace_payloads = false;
+
+    // Shared resources (daemon mode). With no pools, hashing and disk
+    // writes run inline on the session thread; with pools they overlap
+    // with receiving the next blocks.
+    ThreadPool* hash_pool = nullptr;
+    ThreadPool* disk_pool = nullptr;
+    ResourceLimit* connection_limit = nullptr; // open peer connections
+    ResourceLimit* memory_limit = nullptr;     // bytes of block buffers held at once
+
+    // Block requests kept outstanding per connection. Each one holds a
+    // 16 KiB block of `memory_limit` until the block is on disk.
+    int max_in_flight = 16;
+
+    // Give up on a peer that sends or accepts nothing for this long
+    // (connect and handshake included). 0 = wait forever.
+    int peer_timeout_ms = 30000;
+
+    // When cancelled the download stops with an exception: the peer socket
+    // is shut down, so even a session blocked on the network returns.
+    CancelToken* cancel = nullptr;
+    // Incremented by the size of every piece once it is verified.
+    std::atomic<int64_t>* progress = nullptr;
+};
+
+struct ReplayOptions {
+    // Delay scale: 1.0 = recorded timing, 2.0 = twice as fast, 0 = no waiting.
+    double speed = 1.0;
+    // Which recorded connection to replay.
+    uint32_t conn_id = 0;
+    // Request pipeline depth, which may differ from the recorded session's.
+    int max_in_flight = 16;
+};
 
 bool download_piece_to_file(
     const std::string& torrent_path,
-    int piece_index,
+    int64_t piece_index,
     const std::string& output_path
 );
 
 bool download_file(
     const std::string& torrent_path,
-    const std::string& output_path
-);
\ No newline at end of file
+    const std::string& output_path,
+    const DownloadOptions& options = {}
+);
+
+// Same as download_file for a torrent that is already loaded.
+bool download_torrent(
+    const torrent::Torrent& t,
+    const std::string& output_path,
+    const DownloadOptions& options = {}
+);
+
+// Runs the download session against a recorded trace instead of the network.
+bool replay_download(
+    const std::string& trace_path,
+    const std::string& torrent_path,
+    const std::string& output_path,
+    const ReplayOptions& options = {}
+);
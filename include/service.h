@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "concurrency.h"
+#include "torrent.h"
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Long-running multi-torrent daemon.
+//
+// All torrents share one set of resources: a session pool that bounds how
+// many downloads talk to peers at once, one hashing pool, one disk pool, a
+// global connection limit and a global budget for in-flight block data.
+// Parsed metadata is cached in the state directory, so a restart reloads
+// every job without re-reading or re-hashing .torrent files.
+//
+// Control protocol: one JSON request per line on a Unix stream socket,
+// one JSON reply per line. Paths must be absolute; the daemon does not
+// share the client's working directory.
+//   {"cmd":"add","torrent":<path>,"output":<path>} -> {"ok":true,"info_hash":"..."}
+//   {"cmd":"remove","info_hash":<hex>}             -> {"ok":true}
+//   {"cmd":"status"}                               -> {"ok":true,"jobs":[...],"metrics":{...}}
+//   {"cmd":"shutdown"}                             -> {"ok":true}
+namespace service {
+
+    struct Config {
+        std::string socket_path;
+        std::string state_dir;
+        unsigned max_active = 8;          // downloads running at once
+        unsigned hash_threads = 0;        // 0 = one per hardware thread
+        unsigned disk_threads = 2;
+        int64_t max_connections = 64;
+        int64_t memory_limit = 256 * 1024 * 1024; // bytes of in-flight blocks across all jobs
+        int peer_timeout_ms = 30000;      // drop a peer that stalls this long
+    };
+
+    class Daemon {
+    public:
+        explicit Daemon(Config config);
+        ~Daemon();
+
+        Daemon(const Daemon&) = delete;
+        Daemon& operator=(const Daemon&) = delete;
+
+        // Serves the control socket until "shutdown" or SIGINT/SIGTERM.
+        void run();
+
+        // Executes one JSON control request and returns the JSON reply.
+        json handle_command(const std::string& line);
+
+    private:
+        enum class State { Queued, Running, Done, Failed };
+
+        struct Job {
+            torrent::Torrent meta;
+            std::string output_path;
+            std::atomic<State> state{State::Queued};
+            CancelToken cancel;
+            std::atomic<int64_t> bytes_done{0};
+            std::string error; // guarded by Daemon::mutex_
+        };
+
+        json add(const std::string& torrent_path, const std::string& output_path);
+        json remove(const std::string& info_hash_hex);
+        json status();
+
+        void enqueue(const std::shared_ptr<Job>& job);
+        void run_job(const std::shared_ptr<Job>& job);
+        void load_cache();
+        void save_cache(const Job& job);
+        std::string cache_path(const std::string& info_hash_hex) const;
+
+        static const char* state_name(State s);
+
+        Config config_;
+        std::mutex mutex_;
+        std::map<std::string, std::shared_ptr<Job>> jobs_; // by hex info hash
+        std::atomic<bool> stopping_{false};
+
+        // Members are destroyed bottom-up: sessions_ drains first, while the
+        // limits and the hash/disk pools its downloads use are still alive.
+        ResourceLimit connections_;
+        ResourceLimit memory_;
+        ThreadPool hash_pool_;
+        ThreadPool disk_pool_;
+        ThreadPool sessions_;
+    };
+
+    // Sends one JSON request line to a running daemon and returns its reply line.
+    std::string send_command(const std::string& socket_path, const std::string& command);
+
+} // namespace service
@@ -3,30 +3,67 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <cstdint>
-#include "../lib/nlohmann/json.hpp" // Adjust path
+#include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
 namespace torrent {
 
+    // One file of a v2 "file tree". In v2 every file starts on a piece
+    // boundary, so `offset` is its position in the piece-aligned payload.
+    struct FileV2 {
+        std::string path; // components joined with '/'
+        int64_t length;
+        int64_t offset;
+        std::string pieces_root; // 32-byte Merkle root, empty for empty files
+    };
+
     // Represents the "info" dictionary within a torrent file.
     struct Info {
         std::string name;
-        int64_t length;
+        int64_t length; // of the payload including any padding between files
         int64_t piece_length;
         std::string pieces_hash_concat; // The raw concatenated SHA-1 hashes
-         int num_pieces; // Add this
+        int64_t num_pieces;
+
+        // v2 / hybrid ("meta version" 2). A hybrid torrent has both the v1
+        // piece hashes and the v2 tree, laid out identically.
+        bool has_v1 = true;
+        bool has_v2 = false;
+        std::vector<FileV2> files_v2; // in piece order
+        std::map<std::string, std::string> piece_layers; // pieces root -> concatenated SHA-256 piece hashes
+
         json to_json() const; // For bencoding
     };
 
+    // Where a piece sits in the v2 tree and what it must hash to.
+    struct PieceV2 {
+        const FileV2* file;
+        int64_t index_in_file;
+        int64_t size;       // bytes of file data in the piece
+        std::string hash;   // piece-layer entry, or the pieces root for a one-piece file
+        int64_t leaf_count; // leaves under `hash`, padding included
+    };
+    PieceV2 locate_piece_v2(const Info& info, int64_t piece_index);
+
+    // Builds the nested v2 "file tree" dictionary from its flattened form.
+    json file_tree(const std::vector<FileV2>& files);
+
     // Represents the entire torrent file.
     struct Torrent {
         std::string announce_url;
         Info info;
 
-        std::string info_hash_raw; // 20-byte raw SHA-1 hash
+        std::string info_hash_raw; // 20-byte hash used on the wire: SHA-1, or truncated SHA-256 for v2-only
         std::string info_hash_hex; // 40-char hex representation
+        std::string info_hash_v2;  // 32-byte SHA-256 of the info dictionary (v2 / hybrid)
+
+        // Already-parsed form, info hash included, so a cached torrent can be
+        // reloaded without re-encoding and re-hashing the info dictionary.
+        json to_json() const;
+        static Torrent from_json(const json& j);
     };
 
     // Loads a torrent file from the given path and returns a populated Torrent struct.
@@ -0,0 +1,36 @@
+#ifndef TORRENT_CREATOR_H
+#define TORRENT_CREATOR_H
+
+#include <string>
+#include <cstdint>
+
+namespace torrent {
+
+    // Which metainfo to produce. V2 and Hybrid lay every file out on a
+    // piece boundary; Hybrid adds v1 pad files so both views agree.
+    enum class Format { V1, V2, Hybrid };
+
+    struct CreateOptions {
+        std::string announce_url; // required
+        Format format = Format::V1;
+        int64_t piece_length = 0; // 0 = choose from the payload size
+        unsigned threads = 0;     // 0 = one per hardware thread
+    };
+
+    // Piece length used when none is given: the smallest power of two in
+    // [16 KiB, 16 MiB] that keeps the torrent at or under ~2000 pieces.
+    int64_t auto_piece_length(int64_t total_length);
+
+    // Builds a .torrent for a file or directory and writes it to
+    // `output_path`. Pieces are hashed in parallel (SHA-1 and/or SHA-256
+    // Merkle leaves, depending on the format), each worker memory-mapping
+    // only the files its current pieces cover; v1 pieces may span file
+    // boundaries. Returns the hex info hash used on the wire (SHA-1, or the
+    // truncated SHA-256 for v2-only).
+    std::string create_torrent(const std::string& input_path,
+                               const std::string& output_path,
+                               const CreateOptions& options);
+
+} // namespace torrent
+
+#endif // TORRENT_CREATOR_H
@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Compact binary recording of peer-wire traffic.
+//
+// File layout (all integers little-endian):
+//   header : "BTTRACE1" | u32 flags | 20-byte info hash
+//   record : u64 t_us | u32 conn_id | u8 kind | u8 direction | u8 msg_id
+//            | u32 wire_len | u32 stored_len | stored_len bytes
+//
+// t_us is measured from the moment the writer was opened. For frames,
+// wire_len is the length prefix from the wire (id + payload) and the stored
+// bytes are the payload. Piece messages (id=7) keep only their 8-byte
+// index/begin header unless the trace was opened with payloads enabled.
+namespace trace {
+
+    enum class Kind : uint8_t { Open = 0, Frame = 1, Close = 2 };
+    enum class Direction : uint8_t { Out = 0, In = 1 };
+
+    constexpr uint32_t FLAG_PAYLOADS = 1;
+
+    struct Record {
+        uint64_t t_us = 0;
+        uint32_t conn_id = 0;
+        Kind kind = Kind::Frame;
+        Direction direction = Direction::In;
+        uint8_t msg_id = 0;
+        uint32_t wire_len = 0;
+        // Payload (possibly truncated) or, for Open, the peer address. Not
+        // owned: it points into the Trace's mapping, or into the caller's
+        // buffer for records being written.
+        const uint8_t* data = nullptr;
+        uint32_t size = 0;
+    };
+
+    class Writer {
+    public:
+        Writer(const std::string& path, const std::string& info_hash, bool record_payloads);
+
+        // Registers a new connection and returns its id.
+        uint32_t open_connection(const std::string& address);
+        // Never throws (connections close from destructors); a failed
+        // write is reported by finish().
+        void close_connection(uint32_t conn_id) noexcept;
+        void frame(uint32_t conn_id, Direction dir, uint8_t msg_id, const std::vector<uint8_t>& payload);
+
+        // Flushes the file; throws if any record could not be written.
+        void finish();
+
+    private:
+        void write_record(const Record& r);
+
+        std::mutex mutex_;
+        std::ofstream out_;
+        bool record_payloads_;
+        uint32_t next_conn_id_ = 0;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    struct Trace {
+        uint32_t flags = 0;
+        std::string info_hash;
+        std::vector<Record> records;
+        std::shared_ptr<const void> mapping; // keeps the records' data mapped
+
+        bool has_payloads() const { return flags & FLAG_PAYLOADS; }
+    };
+
+    // Maps a trace file read-only and indexes its records. Payloads are not
+    // copied, so a capture larger than RAM can still be replayed.
+    Trace read_file(const std::string& path);
+
+} // namespace trace
@@ -2,6 +2,9 @@
 #define UTILS_H
 
 #include <string>
+#include <cstddef>
+
+struct evp_md_ctx_st; // OpenSSL's EVP_MD_CTX, kept out of this header
 
 // A namespace helps prevent naming conflicts
 namespace utils {
@@ -15,6 +18,42 @@ namespace utils {
     // Computes the SHA-1 hash of a string.
     std::string sha1_hash(const std::string& data);
 
+    // Computes the SHA-256 hash of a string (v2 info hash, Merkle nodes).
+    std::string sha256_hash(const std::string& data);
+
+    // Incremental SHA-1 for data that does not sit in one contiguous buffer
+    // (pieces spanning several files, blocks arriving one by one).
+    class Sha1 {
+    public:
+        Sha1();
+        ~Sha1();
+        Sha1(const Sha1&) = delete;
+        Sha1& operator=(const Sha1&) = delete;
+
+        void update(const void* data, size_t len);
+        // Returns the raw 20-byte digest and resets for reuse.
+        std::string finish();
+
+    private:
+        evp_md_ctx_st* ctx_;
+    };
+
+    // Incremental SHA-256, same interface as Sha1 with a 32-byte digest.
+    class Sha256 {
+    public:
+        Sha256();
+        ~Sha256();
+        Sha256(const Sha256&) = delete;
+        Sha256& operator=(const Sha256&) = delete;
+
+        void update(const void* data, size_t len);
+        // Returns the raw 32-byte digest and resets for reuse.
+        std::string finish();
+
+    private:
+        evp_md_ctx_st* ctx_;
+    };
+
 } // namespace utils
 
 #endif // UTILS_H
\ No newline at end of file
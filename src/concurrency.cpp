@@ -0,0 +1,99 @@
+#include "concurrency.h"
+#include <sys/socket.h>
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i) workers_.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+void ThreadPool::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+size_t ThreadPool::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void ThreadPool::worker_loop() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) return; // stopping and drained
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void ResourceLimit::acquire(int64_t amount) {
+    amount = clamp(amount);
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return available_ >= amount; });
+    available_ -= amount;
+}
+
+bool ResourceLimit::try_acquire(int64_t amount) {
+    amount = clamp(amount);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (available_ < amount) return false;
+    available_ -= amount;
+    return true;
+}
+
+void ResourceLimit::release(int64_t amount) {
+    amount = clamp(amount);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        available_ += amount;
+    }
+    cv_.notify_all();
+}
+
+int64_t ResourceLimit::in_use() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_ - available_;
+}
+
+ResourceLimit::Lease::Lease(ResourceLimit* limit, int64_t amount) : limit_(limit), amount_(amount) {
+    if (limit_) limit_->acquire(amount_);
+}
+
+ResourceLimit::Lease::~Lease() {
+    if (limit_) limit_->release(amount_);
+}
+
+void CancelToken::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    for (int fd : fds_) shutdown(fd, SHUT_RDWR);
+}
+
+CancelToken::Watch::Watch(CancelToken* token, int fd) : token_(token), fd_(fd) {
+    if (!token_) return;
+    std::lock_guard<std::mutex> lock(token_->mutex_);
+    token_->fds_.insert(fd_);
+    if (token_->cancelled_) shutdown(fd_, SHUT_RDWR);
+}
+
+CancelToken::Watch::~Watch() {
+    if (!token_) return;
+    std::lock_guard<std::mutex> lock(token_->mutex_);
+    token_->fds_.erase(fd_);
+}
@@ -0,0 +1,310 @@
+#include "log.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace logging {
+
+    std::atomic<int> g_level{static_cast<int>(Level::Warn)};
+
+    namespace {
+
+        struct Record {
+            Level level = Level::Info;
+            const char* component = "";
+            uint64_t seq = 0;
+            int64_t time_us = 0; // since the Unix epoch
+            uint32_t thread = 0;
+            std::string message;
+        };
+
+        // Single-producer/single-consumer ring: the owning thread pushes,
+        // the writer drains. Neither side ever blocks the other.
+        class ThreadQueue {
+        public:
+            static constexpr size_t CAPACITY = 1024;
+
+            explicit ThreadQueue(uint32_t thread_id) : id(thread_id) {}
+
+            void push(Record&& r) {
+                size_t head = head_.load(std::memory_order_relaxed);
+                if (head - tail_.load(std::memory_order_acquire) == CAPACITY) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                slots_[head % CAPACITY] = std::move(r);
+                head_.store(head + 1, std::memory_order_release);
+            }
+
+            template <typename F>
+            void drain(F&& sink) {
+                size_t tail = tail_.load(std::memory_order_relaxed);
+                size_t head = head_.load(std::memory_order_acquire);
+                for (; tail != head; ++tail) sink(std::move(slots_[tail % CAPACITY]));
+                tail_.store(tail, std::memory_order_release);
+            }
+
+            bool empty() const {
+                return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+            }
+
+            const uint32_t id;
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<bool> orphaned{false}; // the owning thread has exited
+
+        private:
+            std::array<Record, CAPACITY> slots_;
+            alignas(64) std::atomic<size_t> head_{0};
+            alignas(64) std::atomic<size_t> tail_{0};
+        };
+
+        struct State {
+            // Guards everything below except `seq` and `running`. Producers
+            // only take it once per thread, to register their queue.
+            std::mutex mutex;
+            std::vector<std::shared_ptr<ThreadQueue>> queues;
+            uint32_t next_thread_id = 1;
+
+            std::atomic<uint64_t> seq{0};
+            std::atomic<bool> running{false};
+
+            std::thread writer;
+            std::condition_variable wake;
+            std::condition_variable flushed;
+            bool stopping = false;
+            uint64_t flush_requested = 0;
+            uint64_t flush_done = 0;
+            std::FILE* out = stderr;
+            bool json = false;
+        };
+
+        State& state() {
+            static State s;
+            return s;
+        }
+
+        // Marks the queue orphaned when its thread exits; the writer drops
+        // it once drained.
+        struct LocalQueue {
+            std::shared_ptr<ThreadQueue> queue;
+            ~LocalQueue() {
+                if (queue) queue->orphaned = true;
+            }
+        };
+
+        ThreadQueue& local_queue() {
+            thread_local LocalQueue local;
+            if (!local.queue) {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.mutex);
+                local.queue = std::make_shared<ThreadQueue>(s.next_thread_id++);
+                s.queues.push_back(local.queue);
+            }
+            return *local.queue;
+        }
+
+        const char* level_name(Level level) {
+            switch (level) {
+                case Level::Trace: return "TRACE";
+                case Level::Debug: return "DEBUG";
+                case Level::Info: return "INFO";
+                case Level::Warn: return "WARN";
+                case Level::Error: return "ERROR";
+                case Level::Off: break;
+            }
+            return "?";
+        }
+
+        int64_t now_us() {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        }
+
+        // Helper: UTC ISO-8601 timestamp with microseconds.
+        std::string timestamp(int64_t time_us) {
+            std::time_t secs = time_us / 1000000;
+            std::tm tm{};
+            gmtime_r(&secs, &tm);
+            char buf[40];
+            size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+            std::snprintf(buf + n, sizeof(buf) - n, ".%06lldZ", static_cast<long long>(time_us % 1000000));
+            return buf;
+        }
+
+        std::string format(const Record& r, bool json) {
+            if (json) {
+                nlohmann::json j{
+                    {"ts", timestamp(r.time_us)},
+                    {"level", level_name(r.level)},
+                    {"thread", r.thread},
+                    {"component", r.component},
+                    {"msg", r.message}};
+                return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n";
+            }
+            std::string line = timestamp(r.time_us) + " " + level_name(r.level);
+            line.resize(line.size() < 33 ? 33 : line.size(), ' ');
+            return line + " t" + std::to_string(r.thread) + " " + r.component + ": " + r.message + "\n";
+        }
+
+        // One writer pass: collects every queued record, restores the global
+        // order and writes the lot with a single fwrite. Returns the count.
+        size_t drain_once(const std::vector<std::shared_ptr<ThreadQueue>>& queues, std::FILE* out, bool json) {
+            std::vector<Record> batch;
+            uint64_t dropped = 0;
+            for (const auto& q : queues) {
+                q->drain([&](Record&& r) { batch.push_back(std::move(r)); });
+                dropped += q->dropped.exchange(0, std::memory_order_relaxed);
+            }
+            if (dropped) {
+                batch.push_back(Record{Level::Warn, "log", state().seq.fetch_add(1), now_us(), 0,
+                                       std::to_string(dropped) + " records dropped (queue full)"});
+            }
+            if (batch.empty()) return 0;
+
+            std::sort(batch.begin(), batch.end(), [](const Record& a, const Record& b) { return a.seq < b.seq; });
+            std::string text;
+            for (const auto& r : batch) text += format(r, json);
+            std::fwrite(text.data(), 1, text.size(), out);
+            std::fflush(out);
+            return batch.size();
+        }
+
+        void writer_loop() {
+            State& s = state();
+            std::unique_lock<std::mutex> lock(s.mutex);
+            for (;;) {
+                uint64_t flush_target = s.flush_requested;
+                bool stop = s.stopping;
+                auto queues = s.queues;
+                lock.unlock();
+                size_t written = drain_once(queues, s.out, s.json);
+                lock.lock();
+
+                std::erase_if(s.queues, [](const auto& q) { return q->orphaned && q->empty(); });
+                s.flush_done = flush_target;
+                s.flushed.notify_all();
+                if (stop) return;
+                // Producers never signal (that would cost them a lock), so
+                // poll; errors and flush() wake the writer early.
+                if (written == 0 && s.flush_requested == flush_target && !s.stopping)
+                    s.wake.wait_for(lock, std::chrono::milliseconds(20));
+            }
+        }
+
+    } // namespace
+
+    Config config_from_env() {
+        Config config;
+        if (const char* level = std::getenv("BITTORRENT_LOG")) {
+            static const std::pair<const char*, Level> names[] = {
+                {"trace", Level::Trace}, {"debug", Level::Debug}, {"info", Level::Info},
+                {"warn", Level::Warn},   {"error", Level::Error}, {"off", Level::Off}};
+            for (const auto& [name, l] : names) {
+                if (std::strcmp(level, name) == 0) config.level = l;
+            }
+        }
+        if (const char* path = std::getenv("BITTORRENT_LOG_FILE")) config.path = path;
+        if (const char* format = std::getenv("BITTORRENT_LOG_FORMAT")) config.json = std::strcmp(format, "json") == 0;
+        return config;
+    }
+
+    void init(const Config& config) {
+        shutdown(); // re-initialising replaces the previous writer
+        State& s = state();
+        set_level(config.level);
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.out = stderr;
+        if (!config.path.empty()) {
+            s.out = std::fopen(config.path.c_str(), "a");
+            if (!s.out) {
+                s.out = stderr;
+                throw std::runtime_error("Failed to open log file: " + config.path);
+            }
+        }
+        s.json = config.json;
+        s.stopping = false;
+        s.writer = std::thread(writer_loop);
+        s.running = true;
+
+        static bool registered = (std::atexit([] { shutdown(); }), true);
+        (void)registered;
+    }
+
+    void shutdown() {
+        State& s = state();
+        std::thread writer;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (!s.running) return;
+            s.running = false;
+            s.stopping = true;
+            writer = std::move(s.writer);
+        }
+        s.wake.notify_one();
+        writer.join();
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.out != stderr) std::fclose(s.out);
+        s.out = stderr;
+        s.flushed.notify_all();
+    }
+
+    void flush() {
+        State& s = state();
+        std::unique_lock<std::mutex> lock(s.mutex);
+        if (!s.running) return;
+        uint64_t ticket = ++s.flush_requested;
+        s.wake.notify_one();
+        s.flushed.wait(lock, [&] { return s.flush_done >= ticket || !s.running; });
+    }
+
+    void write(Level level, const char* component, std::string message) {
+        State& s = state();
+        Record r{level, component, s.seq.fetch_add(1, std::memory_order_relaxed), now_us(), 0, std::move(message)};
+        if (!s.running.load(std::memory_order_acquire)) {
+            // No writer (not initialised, or shut down): write through.
+            std::string line = format(r, false);
+            std::fwrite(line.data(), 1, line.size(), stderr);
+            return;
+        }
+        ThreadQueue& q = local_queue();
+        r.thread = q.id;
+        q.push(std::move(r));
+        if (level >= Level::Error) s.wake.notify_one();
+    }
+
+    RateLimiter::RateLimiter(double per_second)
+        : interval_ns_(static_cast<int64_t>(1e9 / std::max(per_second, 1e-3))),
+          burst_ns_(interval_ns_ * (std::max<int64_t>(1, static_cast<int64_t>(per_second)) - 1)) {}
+
+    bool RateLimiter::allow(uint64_t& suppressed) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+        int64_t next = next_ns_.load(std::memory_order_relaxed);
+        for (;;) {
+            int64_t base = std::max(next, now);
+            if (base - now > burst_ns_) {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (next_ns_.compare_exchange_weak(next, base + interval_ns_, std::memory_order_relaxed)) break;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+} // namespace logging
@@ -9,6 +9,13 @@
 #include <sstream>
 #include <random>
 #include "piece_downloader.h"
+#include "metrics.h"
+#include "torrent_creator.h"
+#include "service.h"
+#include "concurrency.h"
+#include "log.h"
+#include <memory>
+#include <filesystem>
 using namespace std;
 
 void print_full_info(const string& torrent_file_path) {
@@ -30,16 +37,64 @@ void print_full_info(const string& torrent_file_path) {
             ) <<endl;
         }
 
+        if (t.info.has_v2) {
+            cout << "Info Hash v2: " << utils::to_hex(
+                reinterpret_cast<const unsigned char*>(t.info_hash_v2.data()), t.info_hash_v2.size()) << endl;
+            cout << "Files:" << endl;
+            for (const auto& f : t.info.files_v2) {
+                cout << f.path << " " << f.length << " " << utils::to_hex(
+                    reinterpret_cast<const unsigned char*>(f.pieces_root.data()), f.pieces_root.size()) << endl;
+            }
+        }
+
     } catch (const exception& e) {
         cerr << "Error: " << e.what() << endl;
         exit(1);
     }
 }
 
+// Rate baseline for print_progress(): bytes received at the last redraw and when.
+struct ProgressBaseline {
+    double bytes_in = metrics::global().bytes_in.load();
+    metrics::Clock::time_point time = metrics::Clock::now();
+};
+
+// One-line live view of the download, redrawn in place on stderr.
+void print_progress(ProgressBaseline& last) {
+    json s = metrics::global().snapshot();
+    double total = s["bytes_total"].get<uint64_t>();
+    double done = s["bytes_verified"].get<uint64_t>();
+    double in = s["bytes_in"].get<uint64_t>();
+    auto now = metrics::Clock::now();
+    double secs = chrono::duration<double>(now - last.time).count();
+    double rate = secs > 0 ? (in - last.bytes_in) / secs : 0;
+    last = {in, now};
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "\r[%5.1f%%] %.1f/%.1f MiB  %.2f MiB/s  in-flight %lld  pieces ok %llu bad %llu  "
+             "rtt p50 %.1fms p99 %.1fms  hash p50 %.1fms  disk p50 %.1fms  choked %.1fs ",
+             total > 0 ? 100.0 * done / total : 0.0, done / 1048576.0, total / 1048576.0, rate / 1048576.0,
+             (long long)s["blocks_in_flight"].get<int64_t>(),
+             (unsigned long long)s["pieces_verified"].get<uint64_t>(),
+             (unsigned long long)s["pieces_failed"].get<uint64_t>(),
+             s["request_rtt_us"]["p50"].get<uint64_t>() / 1000.0,
+             s["request_rtt_us"]["p99"].get<uint64_t>() / 1000.0,
+             s["hash_us"]["p50"].get<uint64_t>() / 1000.0,
+             s["disk_write_us"]["p50"].get<uint64_t>() / 1000.0,
+             s["choked_us"].get<uint64_t>() / 1e6);
+    cerr << line;
+}
+
 int main(int argc, char* argv[]) {
-    // Flush after every cout / cerr
-    cout << unitbuf;
-    cerr << unitbuf;
+    // Diagnostics go through the asynchronous logger (BITTORRENT_LOG=debug
+    // etc., see log.h); stdout carries only command output.
+    try {
+        logging::init(logging::config_from_env());
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
 
     if (argc < 2) {
         cerr << "Usage: " << argv[0] << " <command> [args]" << endl;
@@ -131,7 +186,7 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     string torrent_path = argv[argi];
-    int piece_index = stoi(argv[argi + 1]);
+    int64_t piece_index = stoll(argv[argi + 1]);
     try {
         if (download_piece_to_file(torrent_path, piece_index, output_path)) {
             cout << "Piece downloaded successfully." << endl;
@@ -144,26 +199,196 @@ int main(int argc, char* argv[]) {
 
     else if (command == "download") {
     string output_path;
-    int argi = 2;
-    if (argc > 2 && std::string(argv[2]) == "-o") {
-        output_path = argv[3];
-        argi += 2;
+    string torrent_path;
+    bool show_stats = false;
+    string metrics_json_path;
+    string metrics_prom_path;
+    int metrics_interval_ms = 1000;
+    DownloadOptions options;
+    int64_t memory_budget = 0;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) output_path = argv[++i];
+        else if (arg == "--stats") show_stats = true;
+        else if (arg == "--record" && i + 1 < argc) options.trace_path = argv[++i];
+        else if (arg == "--record-payloads") options.trace_payloads = true;
+        else if (arg == "--memory-budget-mb" && i + 1 < argc) memory_budget = stoll(argv[++i]) * 1024 * 1024;
+        else if (arg == "--max-in-flight" && i + 1 < argc) options.max_in_flight = stoi(argv[++i]);
+        else if (arg == "--metrics-json" && i + 1 < argc) metrics_json_path = argv[++i];
+        else if (arg == "--metrics-prom" && i + 1 < argc) metrics_prom_path = argv[++i];
+        else if (arg == "--metrics-interval" && i + 1 < argc) metrics_interval_ms = stoi(argv[++i]);
+        else torrent_path = arg;
     }
-    if (argc <= argi) {
-        cerr << "Usage: " << argv[0] << " download -o <output_path> <torrent_file>" << endl;
+    if (torrent_path.empty()) {
+        cerr << "Usage: " << argv[0] << " download [--stats] [--metrics-json <file>] [--metrics-prom <file>]"
+             << " [--metrics-interval <ms>] [--record <trace_file> [--record-payloads]]"
+             << " [--memory-budget-mb <n>] [--max-in-flight <n>]"
+             << " -o <output_path> <torrent_file>" << endl;
         return 1;
     }
-    string torrent_path = argv[argi];
+
+    unique_ptr<ResourceLimit> memory_limit;
+    if (memory_budget > 0) {
+        memory_limit = make_unique<ResourceLimit>(memory_budget);
+        options.memory_limit = memory_limit.get();
+    }
+
+    unique_ptr<metrics::Reporter> reporter;
+    if (show_stats || !metrics_json_path.empty() || !metrics_prom_path.empty()) {
+        // The rate baseline starts now, not at the first redraw.
+        reporter = make_unique<metrics::Reporter>(chrono::milliseconds(metrics_interval_ms),
+                                                  [=, baseline = ProgressBaseline{}]() mutable {
+            if (show_stats) print_progress(baseline);
+            if (!metrics_json_path.empty()) metrics::append_json_line(metrics_json_path);
+            if (!metrics_prom_path.empty()) metrics::write_prometheus_file(metrics_prom_path);
+        });
+    }
     try {
-        if (download_file(torrent_path, output_path)) {
+        bool ok = download_file(torrent_path, output_path, options);
+        reporter.reset(); // final report before the result line
+        if (show_stats) cerr << endl;
+        if (ok) {
            cout << "File downloaded successfully." << endl;
         }
     } catch (const exception& e) {
+        reporter.reset();
+        if (show_stats) cerr << endl;
         cerr << "Download failed: " << e.what() << endl;
         return 1;
     }
     }
 
+    else if (command == "replay") {
+    string output_path = "/dev/null";
+    vector<string> positional;
+    ReplayOptions options;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) output_path = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc) options.speed = stod(argv[++i]);
+        else if (arg == "--conn" && i + 1 < argc) options.conn_id = stoul(argv[++i]);
+        else if (arg == "--max-in-flight" && i + 1 < argc) options.max_in_flight = stoi(argv[++i]);
+        else positional.push_back(arg);
+    }
+    if (positional.size() != 2) {
+        cerr << "Usage: " << argv[0] << " replay [--speed <factor>] [--conn <id>] [--max-in-flight <n>] [-o <output_path>]"
+             << " <trace_file> <torrent_file>" << endl;
+        return 1;
+    }
+    try {
+        auto start = metrics::Clock::now();
+        replay_download(positional[0], positional[1], output_path, options);
+        double secs = metrics::micros_since(start) / 1e6;
+        json s = metrics::global().snapshot();
+        json summary{
+            {"elapsed_s", secs},
+            // Traces recorded without payloads replay zeros that are never checked.
+            {"bytes_received", s["bytes_received"]},
+            {"bytes_verified", s["bytes_verified"]},
+            {"mb_per_s", secs > 0 ? s["bytes_received"].get<uint64_t>() / secs / 1048576.0 : 0.0},
+            {"request_rtt_us", s["request_rtt_us"]},
+            {"choked_us", s["choked_us"]}};
+        cout << summary.dump() << endl;
+    } catch (const exception& e) {
+        cerr << "Replay failed: " << e.what() << endl;
+        return 1;
+    }
+    }
+
+    else if (command == "create") {
+    string output_path;
+    string input_path;
+    torrent::CreateOptions options;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) output_path = argv[++i];
+        else if (arg == "-t" && i + 1 < argc) options.announce_url = argv[++i];
+        else if (arg == "-l" && i + 1 < argc) options.piece_length = stoll(argv[++i]);
+        else if (arg == "-j" && i + 1 < argc) options.threads = stoul(argv[++i]);
+        else if (arg == "--v2") options.format = torrent::Format::V2;
+        else if (arg == "--hybrid") options.format = torrent::Format::Hybrid;
+        else input_path = arg;
+    }
+    if (input_path.empty() || options.announce_url.empty()) {
+        cerr << "Usage: " << argv[0] << " create -t <announce_url> [-o <output.torrent>]"
+             << " [-l <piece_length>] [-j <threads>] [--v2 | --hybrid] <file_or_directory>" << endl;
+        return 1;
+    }
+    if (output_path.empty()) {
+        string base = input_path;
+        while (base.size() > 1 && base.back() == '/') base.pop_back();
+        output_path = base + ".torrent";
+    }
+    try {
+        string info_hash = torrent::create_torrent(input_path, output_path, options);
+        cout << "Created " << output_path << endl;
+        cout << "Info Hash: " << info_hash << endl;
+    } catch (const exception& e) {
+        cerr << "Create failed: " << e.what() << endl;
+        return 1;
+    }
+    }
+
+    else if (command == "daemon") {
+    service::Config config;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        string value = argv[i + 1];
+        if (arg == "--socket") config.socket_path = value;
+        else if (arg == "--state-dir") config.state_dir = value;
+        else if (arg == "--max-active") config.max_active = stoul(value);
+        else if (arg == "--hash-threads") config.hash_threads = stoul(value);
+        else if (arg == "--disk-threads") config.disk_threads = stoul(value);
+        else if (arg == "--max-connections") config.max_connections = stoll(value);
+        else if (arg == "--memory-limit-mb") config.memory_limit = stoll(value) * 1024 * 1024;
+        else if (arg == "--peer-timeout-ms") config.peer_timeout_ms = stoi(value);
+        else {
+            cerr << "Unknown daemon option: " << arg << endl;
+            return 1;
+        }
+    }
+    if (config.socket_path.empty()) {
+        cerr << "Usage: " << argv[0] << " daemon --socket <path> [--state-dir <dir>] [--max-active <n>]"
+             << " [--hash-threads <n>] [--disk-threads <n>] [--max-connections <n>] [--memory-limit-mb <n>]"
+             << " [--peer-timeout-ms <ms>]" << endl;
+        return 1;
+    }
+    try {
+        service::Daemon daemon(config);
+        daemon.run();
+    } catch (const exception& e) {
+        cerr << "Daemon failed: " << e.what() << endl;
+        return 1;
+    }
+    }
+
+    else if (command == "ctl") {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " ctl <socket> add <torrent_file> <output_path> | remove <info_hash> | status | shutdown" << endl;
+        return 1;
+    }
+    string cmd = argv[3];
+    json request = {{"cmd", cmd}};
+    if (cmd == "add" && argc == 6) {
+        // Resolve against our working directory; the daemon has its own.
+        request["torrent"] = filesystem::absolute(argv[4]).string();
+        request["output"] = filesystem::absolute(argv[5]).string();
+    } else if (cmd == "remove" && argc == 5) {
+        request["info_hash"] = argv[4];
+    } else if (!((cmd == "status" || cmd == "shutdown") && argc == 4)) {
+        cerr << "Usage: " << argv[0] << " ctl <socket> add <torrent_file> <output_path> | remove <info_hash> | status | shutdown" << endl;
+        return 1;
+    }
+    try {
+        string reply = service::send_command(argv[2], request.dump());
+        cout << reply << endl;
+        if (json::parse(reply).value("ok", false) == false) return 1;
+    } catch (const exception& e) {
+        cerr << "Control command failed: " << e.what() << endl;
+        return 1;
+    }
+    }
+
     else {
         cerr << "unknown command: " << command << endl;
         return 1;
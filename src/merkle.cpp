@@ -0,0 +1,55 @@
+#include "merkle.h"
+#include "utils.h"
+#include <stdexcept>
+
+namespace merkle {
+
+    int64_t next_pow2(int64_t n) {
+        int64_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    int64_t num_leaves(int64_t length) {
+        return (length + LEAF_SIZE - 1) / LEAF_SIZE;
+    }
+
+    std::string hash_leaf(const void* data, size_t len) {
+        utils::Sha256 sha;
+        sha.update(data, len);
+        return sha.finish();
+    }
+
+    std::string pad_hash(int64_t width) {
+        return root(std::string(), width);
+    }
+
+    std::string root(const std::string& nodes, int64_t width, const std::string& pad) {
+        int64_t count = nodes.size() / HASH_SIZE;
+        if (nodes.size() % HASH_SIZE != 0 || width < 1 || next_pow2(width) != width || count > width)
+            throw std::invalid_argument("Bad Merkle layer");
+
+        // Only the populated prefix of each layer is materialised; the rest
+        // is `pad`, which doubles up one level at a time.
+        utils::Sha256 sha;
+        std::string layer = nodes;
+        std::string layer_pad = pad;
+        for (; width > 1; width /= 2) {
+            int64_t parents = (count + 1) / 2;
+            std::string next(parents * HASH_SIZE, '\0');
+            for (int64_t i = 0; i < parents; ++i) {
+                sha.update(layer.data() + 2 * i * HASH_SIZE, HASH_SIZE);
+                if (2 * i + 1 < count) sha.update(layer.data() + (2 * i + 1) * HASH_SIZE, HASH_SIZE);
+                else sha.update(layer_pad.data(), HASH_SIZE);
+                next.replace(i * HASH_SIZE, HASH_SIZE, sha.finish());
+            }
+            sha.update(layer_pad.data(), HASH_SIZE);
+            sha.update(layer_pad.data(), HASH_SIZE);
+            layer_pad = sha.finish();
+            layer = std::move(next);
+            count = parents;
+        }
+        return count ? layer : layer_pad;
+    }
+
+} // namespace merkle
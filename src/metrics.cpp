@@ -0,0 +1,223 @@
+#include "metrics.h"
+#include "log.h"
+#include <bit>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace metrics {
+
+    void Histogram::record(uint64_t value) {
+        int bucket = std::min<int>(std::bit_width(value), NUM_BUCKETS - 1);
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::percentile(double p) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total);
+        if (rank >= total) rank = total - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < NUM_BUCKETS; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen > rank) return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+        }
+        return (uint64_t(1) << (NUM_BUCKETS - 1)) - 1;
+    }
+
+    json Histogram::to_json() const {
+        uint64_t n = count();
+        return json{
+            {"count", n},
+            {"mean", n ? static_cast<double>(sum()) / n : 0.0},
+            {"p50", percentile(50)},
+            {"p90", percentile(90)},
+            {"p99", percentile(99)},
+            {"max", percentile(100)}};
+    }
+
+    // Every scrape carries the same fixed set of `le` series, as rate() and
+    // histogram_quantile() expect. The last bucket is open-ended, so it is
+    // only reported through +Inf.
+    void Histogram::write_prometheus(std::string& out, const std::string& name, const std::string& labels) const {
+        std::string sep = labels.empty() ? "" : ",";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < NUM_BUCKETS; ++i) {
+            cumulative += buckets_[i].load(std::memory_order_relaxed);
+            if (i == NUM_BUCKETS - 1) break;
+            uint64_t le = i == 0 ? 0 : (uint64_t(1) << i) - 1;
+            out += name + "_bucket{" + labels + sep + "le=\"" + std::to_string(le) + "\"} "
+                 + std::to_string(cumulative) + "\n";
+        }
+        // Use the bucket total rather than count_, which is updated
+        // separately and could momentarily disagree with the buckets.
+        out += name + "_bucket{" + labels + sep + "le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+        std::string braces = labels.empty() ? "" : "{" + labels + "}";
+        out += name + "_sum" + braces + " " + std::to_string(sum()) + "\n";
+        out += name + "_count" + braces + " " + std::to_string(cumulative) + "\n";
+    }
+
+    json PeerStats::to_json() const {
+        return json{
+            {"address", address},
+            {"bytes_in", bytes_in.load(std::memory_order_relaxed)},
+            {"bytes_out", bytes_out.load(std::memory_order_relaxed)},
+            {"blocks_received", blocks_received.load(std::memory_order_relaxed)},
+            {"blocks_failed", blocks_failed.load(std::memory_order_relaxed)},
+            {"choked_us", choked_us.load(std::memory_order_relaxed)},
+            {"request_rtt_us", request_rtt_us.to_json()}};
+    }
+
+    std::shared_ptr<PeerStats> Registry::peer(const std::string& address) {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        auto& slot = peers_[address];
+        auto stats = slot.lock();
+        if (!stats) {
+            stats = std::make_shared<PeerStats>(address);
+            slot = stats;
+        }
+        // Expired entries are swept once the map has doubled, so a daemon
+        // that nobody scrapes stays proportional to its live connections.
+        if (peers_.size() > 2 * peers_swept_ + 64) {
+            std::erase_if(peers_, [](const auto& entry) { return entry.second.expired(); });
+            peers_swept_ = peers_.size();
+        }
+        return stats;
+    }
+
+    std::vector<std::shared_ptr<PeerStats>> Registry::live_peers() const {
+        std::vector<std::shared_ptr<PeerStats>> live;
+        for (auto it = peers_.begin(); it != peers_.end();) {
+            if (auto stats = it->second.lock()) {
+                live.push_back(std::move(stats));
+                ++it;
+            } else {
+                it = peers_.erase(it);
+            }
+        }
+        return live;
+    }
+
+    json Registry::snapshot() const {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        json peers = json::array();
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            for (const auto& stats : live_peers()) peers.push_back(stats->to_json());
+        }
+        return json{
+            {"timestamp_ms", std::chrono::duration_cast<std::chrono::milliseconds>(now).count()},
+            {"bytes_in", bytes_in.load(std::memory_order_relaxed)},
+            {"bytes_out", bytes_out.load(std::memory_order_relaxed)},
+            {"blocks_in_flight", blocks_in_flight.load(std::memory_order_relaxed)},
+            {"pieces_verified", pieces_verified.load(std::memory_order_relaxed)},
+            {"pieces_failed", pieces_failed.load(std::memory_order_relaxed)},
+            {"blocks_failed", blocks_failed.load(std::memory_order_relaxed)},
+            {"choked_us", choked_us.load(std::memory_order_relaxed)},
+            {"disk_queue_depth", disk_queue_depth.load(std::memory_order_relaxed)},
+            {"bytes_total", bytes_total.load(std::memory_order_relaxed)},
+            {"bytes_received", bytes_received.load(std::memory_order_relaxed)},
+            {"bytes_verified", bytes_verified.load(std::memory_order_relaxed)},
+            {"request_rtt_us", request_rtt_us.to_json()},
+            {"hash_us", hash_us.to_json()},
+            {"disk_write_us", disk_write_us.to_json()},
+            {"tracker_announce_us", tracker_announce_us.to_json()},
+            {"peers", peers}};
+    }
+
+    std::string Registry::prometheus() const {
+        std::string out;
+        auto scalar = [&](const char* name, const char* type, auto value) {
+            out += std::string("# TYPE bittorrent_") + name + " " + type + "\n";
+            out += std::string("bittorrent_") + name + " " + std::to_string(value) + "\n";
+        };
+        scalar("bytes_in_total", "counter", bytes_in.load(std::memory_order_relaxed));
+        scalar("bytes_out_total", "counter", bytes_out.load(std::memory_order_relaxed));
+        scalar("blocks_in_flight", "gauge", blocks_in_flight.load(std::memory_order_relaxed));
+        scalar("pieces_verified_total", "counter", pieces_verified.load(std::memory_order_relaxed));
+        scalar("pieces_failed_total", "counter", pieces_failed.load(std::memory_order_relaxed));
+        scalar("blocks_failed_total", "counter", blocks_failed.load(std::memory_order_relaxed));
+        scalar("choked_us_total", "counter", choked_us.load(std::memory_order_relaxed));
+        scalar("disk_queue_depth", "gauge", disk_queue_depth.load(std::memory_order_relaxed));
+        scalar("bytes_total", "gauge", bytes_total.load(std::memory_order_relaxed));
+        scalar("bytes_received_total", "counter", bytes_received.load(std::memory_order_relaxed));
+        scalar("bytes_verified_total", "counter", bytes_verified.load(std::memory_order_relaxed));
+
+        auto histogram = [&](const char* name, const Histogram& h) {
+            out += std::string("# TYPE bittorrent_") + name + " histogram\n";
+            h.write_prometheus(out, std::string("bittorrent_") + name);
+        };
+        histogram("request_rtt_us", request_rtt_us);
+        histogram("hash_us", hash_us);
+        histogram("disk_write_us", disk_write_us);
+        histogram("tracker_announce_us", tracker_announce_us);
+
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        auto peers = live_peers();
+        if (peers.empty()) return out;
+        out += "# TYPE bittorrent_peer_bytes_in_total counter\n";
+        for (const auto& p : peers)
+            out += "bittorrent_peer_bytes_in_total{peer=\"" + p->address + "\"} "
+                 + std::to_string(p->bytes_in.load(std::memory_order_relaxed)) + "\n";
+        out += "# TYPE bittorrent_peer_bytes_out_total counter\n";
+        for (const auto& p : peers)
+            out += "bittorrent_peer_bytes_out_total{peer=\"" + p->address + "\"} "
+                 + std::to_string(p->bytes_out.load(std::memory_order_relaxed)) + "\n";
+        out += "# TYPE bittorrent_peer_choked_us_total counter\n";
+        for (const auto& p : peers)
+            out += "bittorrent_peer_choked_us_total{peer=\"" + p->address + "\"} "
+                 + std::to_string(p->choked_us.load(std::memory_order_relaxed)) + "\n";
+        out += "# TYPE bittorrent_peer_request_rtt_us histogram\n";
+        for (const auto& p : peers)
+            p->request_rtt_us.write_prometheus(out, "bittorrent_peer_request_rtt_us", "peer=\"" + p->address + "\"");
+        return out;
+    }
+
+    Registry& global() {
+        static Registry registry;
+        return registry;
+    }
+
+    void append_json_line(const std::string& path) {
+        std::ofstream ofs(path, std::ios::app);
+        if (!ofs) throw std::runtime_error("Failed to open metrics file: " + path);
+        ofs << global().snapshot().dump() << '\n';
+    }
+
+    void write_prometheus_file(const std::string& path) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::trunc);
+            if (!ofs) throw std::runtime_error("Failed to open metrics file: " + tmp);
+            ofs << global().prometheus();
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("Failed to replace metrics file: " + path);
+    }
+
+    Reporter::Reporter(std::chrono::milliseconds interval, std::function<void()> sink)
+        : interval_(interval), sink_(std::move(sink)) {
+        thread_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!cv_.wait_for(lock, interval_, [this] { return stop_; })) {
+                lock.unlock();
+                // A failing sink (e.g. a full disk) must not take the download down.
+                try { sink_(); } catch (const std::exception& e) { BT_LOG_WARN("metrics", "report failed: " << e.what()); }
+                lock.lock();
+            }
+        });
+    }
+
+    Reporter::~Reporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        try { sink_(); } catch (const std::exception& e) { BT_LOG_WARN("metrics", "report failed: " << e.what()); }
+    }
+
+} // namespace metrics
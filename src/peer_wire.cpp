@@ -0,0 +1,169 @@
+#include "peer_wire.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace wire {
+
+    // Helper: read a big-endian u32 from a byte buffer.
+    static uint32_t read_u32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return ntohl(v);
+    }
+
+    void Connection::count_out(uint64_t wire_bytes) {
+        stats_->bytes_out.fetch_add(wire_bytes, std::memory_order_relaxed);
+        metrics::global().bytes_out.fetch_add(wire_bytes, std::memory_order_relaxed);
+    }
+
+    void Connection::count_in(uint64_t wire_bytes) {
+        stats_->bytes_in.fetch_add(wire_bytes, std::memory_order_relaxed);
+        metrics::global().bytes_in.fetch_add(wire_bytes, std::memory_order_relaxed);
+    }
+
+    // Helper: the error for a failed socket call, naming a timeout
+    // (SO_RCVTIMEO/SO_SNDTIMEO expired) as such.
+    static std::runtime_error io_error(const char* what) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return std::runtime_error(std::string(what) + ": peer timed out");
+        return std::runtime_error(what);
+    }
+
+    // Helper: receive exactly `len` bytes or throw.
+    static void recv_exact(int sock, void* buf, size_t len, const char* what) {
+        errno = 0;
+        if (::recv(sock, buf, len, MSG_WAITALL) != (ssize_t)len) throw io_error(what);
+    }
+
+    // --- SocketConnection ---
+
+    SocketConnection::SocketConnection(int sock, std::shared_ptr<metrics::PeerStats> stats, trace::Writer* trace)
+        : Connection(std::move(stats)), sock_(sock), trace_(trace) {
+        if (trace_) conn_id_ = trace_->open_connection(stats_->address);
+    }
+
+    SocketConnection::~SocketConnection() {
+        if (trace_) trace_->close_connection(conn_id_);
+        close(sock_);
+    }
+
+    void SocketConnection::send(uint8_t id, const std::vector<uint8_t>& payload) {
+        // One buffer, one syscall: separate writes for the length, id and
+        // payload let Nagle hold back the tail until the peer's delayed ACK.
+        std::vector<uint8_t> frame(5 + payload.size());
+        uint32_t len = htonl(payload.size() + 1);
+        std::memcpy(frame.data(), &len, 4);
+        frame[4] = id;
+        if (!payload.empty()) std::memcpy(frame.data() + 5, payload.data(), payload.size());
+
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            ssize_t n = ::send(sock_, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) throw io_error("Failed to send message");
+            sent += n;
+        }
+        count_out(frame.size());
+        if (trace_) trace_->frame(conn_id_, trace::Direction::Out, id, payload);
+    }
+
+    std::vector<uint8_t> SocketConnection::recv(uint8_t& id) {
+        uint32_t len_n;
+        recv_exact(sock_, &len_n, 4, "Failed to read length");
+        uint32_t len = ntohl(len_n);
+        if (len == 0) throw std::runtime_error("Keep-alive not supported");
+        recv_exact(sock_, &id, 1, "Failed to read id");
+        std::vector<uint8_t> payload(len - 1);
+        if (len > 1) recv_exact(sock_, payload.data(), len - 1, "Failed to read payload");
+        count_in(uint64_t(len) + 4);
+        if (trace_) trace_->frame(conn_id_, trace::Direction::In, id, payload);
+        return payload;
+    }
+
+    // --- ReplayConnection ---
+
+    ReplayConnection::ReplayConnection(const trace::Trace& t, uint32_t conn_id, double speed,
+                                       std::shared_ptr<metrics::PeerStats> stats)
+        : Connection(std::move(stats)), speed_(speed), payloads_(t.has_payloads()), start_(Clock::now()) {
+        bool opened = false;
+        std::map<std::pair<uint32_t, uint32_t>, uint64_t> requested_at;
+        for (const auto& r : t.records) {
+            if (r.conn_id != conn_id) continue;
+            if (r.kind == trace::Kind::Open) {
+                open_t_us_ = r.t_us;
+                opened = true;
+                continue;
+            }
+            if (r.kind != trace::Kind::Frame) continue;
+
+            if (r.direction == trace::Direction::Out) {
+                if (r.msg_id == 6 && r.size >= 8)
+                    requested_at[{read_u32(r.data), read_u32(r.data + 4)}] = r.t_us;
+            } else if (r.msg_id == 7 && r.size >= 8) {
+                std::pair<uint32_t, uint32_t> key{read_u32(r.data), read_u32(r.data + 4)};
+                auto req = requested_at.find(key);
+                uint64_t latency = req != requested_at.end() && r.t_us >= req->second ? r.t_us - req->second : 0;
+                blocks_[key] = RecordedBlock{&r, latency};
+            } else {
+                control_.push_back(&r);
+            }
+        }
+        if (!opened) throw std::runtime_error("Connection " + std::to_string(conn_id) + " not found in trace");
+    }
+
+    ReplayConnection::Clock::time_point ReplayConnection::scaled(Clock::time_point base, uint64_t us) const {
+        if (speed_ <= 0) return base;
+        return base + std::chrono::microseconds(static_cast<int64_t>(us / speed_));
+    }
+
+    std::vector<uint8_t> ReplayConnection::materialize(const trace::Record& r) const {
+        // Without recorded payloads a block is its header followed by zeros.
+        std::vector<uint8_t> payload(r.wire_len - 1, 0);
+        std::memcpy(payload.data(), r.data, std::min<size_t>(r.size, payload.size()));
+        return payload;
+    }
+
+    void ReplayConnection::send(uint8_t id, const std::vector<uint8_t>& payload) {
+        count_out(payload.size() + 5);
+        if (id != 6 || payload.size() < 8) return;
+
+        std::pair<uint32_t, uint32_t> key{read_u32(payload.data()), read_u32(payload.data() + 4)};
+        auto it = blocks_.find(key);
+        if (it == blocks_.end())
+            throw std::runtime_error("Replay: block " + std::to_string(key.first) + "/" +
+                                     std::to_string(key.second) + " was never received in the trace");
+        Pending p{scaled(Clock::now(), it->second.latency_us), it->second.reply};
+        auto pos = std::upper_bound(pending_.begin(), pending_.end(), p.due,
+                                    [](Clock::time_point due, const Pending& e) { return due < e.due; });
+        pending_.insert(pos, p);
+    }
+
+    std::vector<uint8_t> ReplayConnection::recv(uint8_t& id) {
+        const trace::Record* next = nullptr;
+        Clock::time_point due;
+        if (!control_.empty()) {
+            next = control_.front();
+            due = scaled(start_, next->t_us - open_t_us_);
+        }
+        if (!pending_.empty() && (!next || pending_.front().due <= due)) {
+            next = pending_.front().reply;
+            due = pending_.front().due;
+            pending_.pop_front();
+        } else if (next) {
+            control_.pop_front();
+        } else {
+            throw std::runtime_error("Replay: trace exhausted");
+        }
+
+        if (speed_ > 0) std::this_thread::sleep_until(due);
+        id = next->msg_id;
+        std::vector<uint8_t> payload = materialize(*next);
+        count_in(payload.size() + 5);
+        return payload;
+    }
+
+} // namespace wire
@@ -3,193 +3,748 @@
 #include "tracker.h"
 #include "handshake.h"
 #include "utils.h"
-#include <fstream>
+#include "metrics.h"
+#include "peer_wire.h"
+#include "trace.h"
+#include "concurrency.h"
+#include "log.h"
+#include "merkle.h"
 #include <vector>
 #include <random>
+#include <cerrno>
 #include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <future>
+#include <memory>
 #include <stdexcept>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
 constexpr int BLOCK_SIZE = 16 * 1024;
+static_assert(BLOCK_SIZE == merkle::LEAF_SIZE, "v2 checks assume one leaf per block");
 
-static void send_message(int sock, uint8_t id, const std::vector<uint8_t>& payload = {}) {
-    uint32_t len = htonl(payload.size() + 1);
-    send(sock, &len, 4, 0);
-    send(sock, &id, 1, 0);
-    if (!payload.empty()) send(sock, payload.data(), payload.size(), 0);
+// Most leaf hashes asked for in one hash request (id=21).
+constexpr int64_t MAX_HASHES_PER_REQUEST = 512;
+
+// How pieces are checked. Blocks additionally asks a v2-capable peer for
+// the leaf hashes of each piece so a bad block is caught on arrival.
+enum class Verify { None, Pieces, Blocks };
+
+using MessageHandler = std::function<void(uint8_t id, const std::vector<uint8_t>& payload)>;
+
+// Whether the peer is choking us. Kept for the whole session, since a
+// choke can arrive at the end of one piece and last into the next.
+struct ChokeState {
+    bool choked = false;
+    metrics::Clock::time_point since;
+};
+
+// Receives until a piece message (id=7) arrives or the peer chokes (id=0)
+// or unchokes (id=1) us, and returns that message's id. Other messages go
+// to `on_other`. Time spent between a choke and the following unchoke is
+// charged to the peer as choked time.
+static uint8_t recv_piece(wire::Connection& conn, ChokeState& choke, std::vector<uint8_t>& payload,
+                          const MessageHandler& on_other = {}) {
+    uint8_t id;
+    for (;;) {
+        payload = conn.recv(id);
+        if (id == 7) return id;
+        if (id != 0 && id != 1) {
+            if (on_other) on_other(id, payload);
+        } else if (id == 0 && !choke.choked) {
+            choke.choked = true;
+            choke.since = metrics::Clock::now();
+            return id;
+        } else if (id == 1 && choke.choked) {
+            choke.choked = false;
+            uint64_t us = metrics::micros_since(choke.since);
+            conn.stats().choked_us.fetch_add(us, std::memory_order_relaxed);
+            metrics::global().choked_us.fetch_add(us, std::memory_order_relaxed);
+            return id;
+        }
+    }
 }
 
-static std::vector<uint8_t> recv_message(int sock, uint8_t& id) {
-    uint32_t len_n;
-    if (recv(sock, &len_n, 4, MSG_WAITALL) != 4) throw std::runtime_error("Failed to read length");
-    uint32_t len = ntohl(len_n);
-    if (len == 0) throw std::runtime_error("Keep-alive not supported");
-    if (recv(sock, &id, 1, MSG_WAITALL) != 1) throw std::runtime_error("Failed to read id");
-    std::vector<uint8_t> payload(len - 1);
-    if (len > 1 && recv(sock, payload.data(), len - 1, MSG_WAITALL) != (ssize_t)(len - 1))
-        throw std::runtime_error("Failed to read payload");
-    return payload;
+// Waits for the bitfield (id=5), sends interested (id=2) and waits for
+// unchoke (id=1), counting the wait as choked time.
+static void start_session(wire::Connection& conn) {
+    uint8_t id;
+    conn.recv(id); // bitfield
+
+    conn.send(2);
+    auto start = metrics::Clock::now();
+    do { conn.recv(id); } while (id != 1);
+    uint64_t us = metrics::micros_since(start);
+    conn.stats().choked_us.fetch_add(us, std::memory_order_relaxed);
+    metrics::global().choked_us.fetch_add(us, std::memory_order_relaxed);
 }
 
-bool download_piece_to_file(
-    const std::string& torrent_path,
-    int piece_index,
-    const std::string& output_path
-) {
-    // 1. Load torrent and get info
-    auto t = torrent::load_from_file(torrent_path);
+// Size of piece `piece_index`. In v1 only the last piece may be short; in
+// v2 the last piece of every file is.
+static int64_t piece_size(const torrent::Torrent& t, int64_t piece_index) {
+    if (t.info.has_v2) return torrent::locate_piece_v2(t.info, piece_index).size;
+    if (piece_index < 0 || piece_index >= t.info.num_pieces)
+        throw std::runtime_error("Piece index out of range: " + std::to_string(piece_index));
+    int64_t begin = piece_index * t.info.piece_length;
+    return std::min(t.info.piece_length, t.info.length - begin);
+}
 
-    // 2. Get peers
+// Sends a request (id=6) for one block.
+static void send_request(wire::Connection& conn, int64_t piece_index, int64_t offset, int64_t req_len) {
+    std::vector<uint8_t> payload(12);
+    uint32_t idx_n = htonl(static_cast<uint32_t>(piece_index));
+    uint32_t begin_n = htonl(static_cast<uint32_t>(offset));
+    uint32_t len_n = htonl(static_cast<uint32_t>(req_len));
+    std::memcpy(payload.data(), &idx_n, 4);
+    std::memcpy(payload.data() + 4, &begin_n, 4);
+    std::memcpy(payload.data() + 8, &len_n, 4);
+    conn.send(6, payload);
+}
+
+// Sends a hash request (id=21) for `length` leaf hashes of the file with
+// `pieces_root`, starting at leaf `index`, without proof hashes.
+static void send_hash_request(wire::Connection& conn, const std::string& pieces_root, int64_t index, int64_t length) {
+    std::vector<uint8_t> payload(pieces_root.begin(), pieces_root.end());
+    for (uint32_t field : {0u, static_cast<uint32_t>(index), static_cast<uint32_t>(length), 0u}) {
+        uint32_t n = htonl(field);
+        payload.insert(payload.end(), reinterpret_cast<uint8_t*>(&n), reinterpret_cast<uint8_t*>(&n) + 4);
+    }
+    conn.send(21, payload);
+}
+
+// Writes `len` bytes at `offset` in the output file.
+static void write_block(int fd, int64_t offset, const uint8_t* data, size_t len) {
+    auto& reg = metrics::global();
+    auto write_start = metrics::Clock::now();
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = pwrite(fd, data + written, len - written, offset + written);
+        if (n <= 0) throw std::runtime_error("Failed to write output file");
+        written += n;
+    }
+    reg.disk_write_us.record(metrics::micros_since(write_start));
+}
+
+// Collects the results of block writes handed to the disk pool. Errors are
+// surfaced as soon as a finished write is noticed, not only at the end.
+class PendingWrites {
+public:
+    std::shared_ptr<std::promise<void>> add() {
+        auto p = std::make_shared<std::promise<void>>();
+        pending_.push_back(p->get_future());
+        return p;
+    }
+
+    void reap_ready() {
+        while (!pending_.empty() &&
+               pending_.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            pending_.front().get();
+            pending_.pop_front();
+        }
+    }
+
+    ~PendingWrites() {
+        // Never leave tasks referring to this session's state behind.
+        for (auto& f : pending_) f.wait();
+    }
+
+    void wait_all() {
+        while (!pending_.empty()) {
+            pending_.front().get();
+            pending_.pop_front();
+        }
+    }
+
+private:
+    std::deque<std::future<void>> pending_;
+};
+
+// SHA-1 of one piece fed block by block. Blocks must be pushed in order;
+// they are hashed on `pool` (inline without one) by at most one task at a
+// time, so hashing overlaps with the network without reordering.
+class PieceHasher {
+public:
+    explicit PieceHasher(ThreadPool* pool) : pool_(pool) {}
+
+    ~PieceHasher() { wait_idle(); }
+
+    // `data` is kept alive by `owner` until it has been hashed.
+    void push(std::shared_ptr<const void> owner, const uint8_t* data, size_t len) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back({std::move(owner), data, len});
+            if (running_) return;
+            running_ = true;
+        }
+        run_on(pool_, [this] { drain(); });
+    }
+
+    // Waits for queued blocks and returns the raw digest.
+    std::string finish() {
+        wait_idle();
+        return sha_.finish();
+    }
+
+private:
+    struct Chunk {
+        std::shared_ptr<const void> owner;
+        const uint8_t* data;
+        size_t len;
+    };
+
+    void drain() {
+        for (;;) {
+            Chunk c;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (queue_.empty()) {
+                    running_ = false;
+                    idle_.notify_all();
+                    return;
+                }
+                c = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            auto start = metrics::Clock::now();
+            sha_.update(c.data, c.len);
+            metrics::global().hash_us.record(metrics::micros_since(start));
+        }
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return !running_; });
+    }
+
+    ThreadPool* pool_;
+    utils::Sha1 sha_;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::deque<Chunk> queue_;
+    bool running_ = false;
+};
+
+// Checks the blocks of one v2 piece against SHA-256 leaf hashes. Leaves
+// are hashed on `pool` (inline without one) in any order, so unlike the
+// v1 SHA-1 this spreads one piece over every hashing thread. Once the
+// peer's leaf hashes are in and hash up to the piece hash, each block is
+// checked as soon as both its leaf and the expected one are known;
+// without them the leaves are combined and checked as a whole at the end.
+class BlockVerifier {
+public:
+    BlockVerifier(ThreadPool* pool, const torrent::PieceV2& piece)
+        : pool_(pool),
+          piece_hash_(piece.hash),
+          leaf_count_(piece.leaf_count),
+          actual_(merkle::num_leaves(piece.size)),
+          expected_(piece.leaf_count * merkle::HASH_SIZE, '\0') {}
+
+    ~BlockVerifier() { wait_idle(); }
+
+    // `data` is kept alive by `owner` until it has been hashed.
+    void push(std::shared_ptr<const void> owner, const uint8_t* data, size_t len, int64_t leaf) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++running_;
+        }
+        run_on(pool_, [this, owner = std::move(owner), data, len, leaf] {
+            auto start = metrics::Clock::now();
+            std::string h = merkle::hash_leaf(data, len);
+            metrics::global().hash_us.record(metrics::micros_since(start));
+            std::lock_guard<std::mutex> lock(mutex_);
+            actual_[leaf] = std::move(h);
+            check(leaf);
+            if (--running_ == 0) idle_.notify_all();
+        });
+    }
+
+    // Stores `count` expected leaf hashes starting at leaf `first` of the
+    // piece. Returns false once the full set is in and does not hash to
+    // the piece hash.
+    bool add_expected(int64_t first, const uint8_t* hashes, int64_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (trusted_ || !chunks_.insert(first).second) return true;
+        expected_.replace(first * merkle::HASH_SIZE, count * merkle::HASH_SIZE,
+                          reinterpret_cast<const char*>(hashes), count * merkle::HASH_SIZE);
+        received_ += count;
+        if (received_ < leaf_count_) return true;
+        if (merkle::root(expected_, leaf_count_) != piece_hash_) return false;
+        trusted_ = true;
+        for (int64_t i = 0; i < (int64_t)actual_.size(); ++i) check(i);
+        return true;
+    }
+
+    // Leaf index of the first block found bad, or -1.
+    int64_t bad_block() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bad_;
+    }
+
+    // Waits for queued blocks; true when the piece matches its hash.
+    bool finish() {
+        wait_idle();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (bad_ >= 0) return false;
+        if (trusted_) return true; // every block was checked on its own
+        std::string leaves;
+        for (const auto& l : actual_) leaves += l;
+        return merkle::root(leaves, leaf_count_) == piece_hash_;
+    }
+
+private:
+    // Requires mutex_.
+    void check(int64_t leaf) {
+        if (!trusted_ || bad_ >= 0 || actual_[leaf].empty()) return;
+        if (expected_.compare(leaf * merkle::HASH_SIZE, merkle::HASH_SIZE, actual_[leaf]) != 0) bad_ = leaf;
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return running_ == 0; });
+    }
+
+    ThreadPool* pool_;
+    const std::string piece_hash_;
+    const int64_t leaf_count_;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    int running_ = 0;
+    std::vector<std::string> actual_;  // leaf hash per received block
+    std::string expected_;             // leaf hashes from the peer, padding included
+    std::set<int64_t> chunks_;         // first leaf of each hashes message taken
+    int64_t received_ = 0;
+    bool trusted_ = false;
+    int64_t bad_ = -1;
+};
+
+// A received piece message (id=7) and the memory budget it holds. The
+// disk write, the hasher and the reorder buffer share it, so the budget is
+// returned only when the last of them lets go of the data.
+struct ReceivedBlock {
+    std::vector<uint8_t> message; // index, begin, block data
+    std::shared_ptr<ResourceLimit::Lease> lease;
+
+    const uint8_t* data() const { return message.data() + 8; }
+    size_t size() const { return message.size() - 8; }
+};
+
+// Downloads one piece without ever holding all of it: up to
+// `max_in_flight` block requests are outstanding, each block is written at
+// `file_offset + begin` as soon as it arrives and checked: fed to the
+// SHA-1 in order for v1, leaf by leaf for v2. Every block holds BLOCK_SIZE
+// bytes of `options.memory_limit` from its request until it is both on
+// disk and hashed. A choke drops the peer's queue of our requests, so the
+// outstanding blocks keep their budget and are requested again once the
+// peer unchokes us.
+static void stream_piece(wire::Connection& conn, ChokeState& choke, const torrent::Torrent& t,
+                         int64_t piece_index, int fd, int64_t file_offset, Verify verify,
+                         const DownloadOptions& options, PendingWrites& writes) {
+    auto& reg = metrics::global();
+    const int64_t piece_len = piece_size(t, piece_index);
+    const int max_in_flight = std::max(1, options.max_in_flight);
+
+    // Counted in blocks_in_flight for exactly as long as it exists, so
+    // requests dropped when a piece fails are uncounted too.
+    struct Outstanding {
+        explicit Outstanding(std::shared_ptr<ResourceLimit::Lease> l) : sent_at(metrics::Clock::now()), lease(std::move(l)) {
+            metrics::global().blocks_in_flight.fetch_add(1, std::memory_order_relaxed);
+        }
+        ~Outstanding() { metrics::global().blocks_in_flight.fetch_sub(1, std::memory_order_relaxed); }
+        Outstanding(const Outstanding&) = delete;
+        Outstanding& operator=(const Outstanding&) = delete;
+
+        metrics::Clock::time_point sent_at;
+        bool requested = true; // false once a choke has dropped the request
+        std::shared_ptr<ResourceLimit::Lease> lease;
+    };
+    std::map<int64_t, Outstanding> outstanding; // by block offset
+    std::map<int64_t, std::shared_ptr<const ReceivedBlock>> early; // arrived ahead of the hash cursor
+    std::unique_ptr<PieceHasher> hasher;
+    std::unique_ptr<BlockVerifier> verifier;
+    torrent::PieceV2 v2{};
+    int64_t next_request = 0;
+    int64_t next_hash = 0;
+    int64_t received = 0;
+
+    if (verify != Verify::None && t.info.has_v2) {
+        v2 = torrent::locate_piece_v2(t.info, piece_index);
+        verifier = std::make_unique<BlockVerifier>(options.hash_pool, v2);
+    } else if (verify != Verify::None) {
+        hasher = std::make_unique<PieceHasher>(options.hash_pool);
+    }
+
+    // Ask for the piece's leaf hashes ahead of its blocks. A one-leaf piece
+    // needs none: its block hash is the piece hash.
+    const int64_t first_leaf = v2.index_in_file * (t.info.piece_length / merkle::LEAF_SIZE);
+    if (verifier && verify == Verify::Blocks && v2.leaf_count > 1) {
+        for (int64_t first = 0; first < v2.leaf_count; first += MAX_HASHES_PER_REQUEST)
+            send_hash_request(conn, v2.file->pieces_root, first_leaf + first,
+                              std::min(MAX_HASHES_PER_REQUEST, v2.leaf_count - first));
+    }
+    // Hashes (id=22) for this piece feed the verifier; a reject (id=23) or
+    // a reply for some other piece is ignored and the piece is then checked
+    // as a whole.
+    MessageHandler on_other = [&](uint8_t id, const std::vector<uint8_t>& payload) {
+        if (id == 23 && verifier) BT_LOG_DEBUG("peer", conn.stats().address << " rejected a hash request for piece " << piece_index);
+        if (!verifier || id != 22 || payload.size() < 48) return;
+        auto field = [&](size_t at) {
+            uint32_t v;
+            std::memcpy(&v, payload.data() + at, 4);
+            return static_cast<int64_t>(ntohl(v));
+        };
+        int64_t first = field(36) - first_leaf;
+        int64_t count = field(40);
+        if (std::memcmp(payload.data(), v2.file->pieces_root.data(), merkle::HASH_SIZE) != 0 || field(32) != 0 ||
+            first < 0 || count <= 0 || first + count > v2.leaf_count)
+            return;
+        if (payload.size() < 48 + count * merkle::HASH_SIZE) throw std::runtime_error("Malformed hashes message");
+        if (!verifier->add_expected(first, payload.data() + 48, count))
+            throw std::runtime_error("Peer " + conn.stats().address + " sent leaf hashes that do not match piece " +
+                                     std::to_string(piece_index));
+    };
+    auto reject_block = [&](int64_t leaf) {
+        BT_LOG_WARN("peer", conn.stats().address << " sent a bad block: piece " << piece_index << " offset "
+                                                 << leaf * BLOCK_SIZE);
+        reg.blocks_failed.fetch_add(1, std::memory_order_relaxed);
+        reg.pieces_failed.fetch_add(1, std::memory_order_relaxed);
+        conn.stats().blocks_failed.fetch_add(1, std::memory_order_relaxed);
+        throw std::runtime_error("Block at offset " + std::to_string(leaf * BLOCK_SIZE) + " of piece " +
+                                 std::to_string(piece_index) + " from peer " + conn.stats().address +
+                                 " failed verification");
+    };
+
+    while (received < piece_len) {
+        if (!choke.choked) {
+            // Re-request what an earlier choke dropped.
+            for (auto& [offset, o] : outstanding) {
+                if (o.requested) continue;
+                send_request(conn, piece_index, offset, std::min<int64_t>(BLOCK_SIZE, piece_len - offset));
+                o.sent_at = metrics::Clock::now();
+                o.requested = true;
+            }
+        }
+        // Fill the request window. With requests already outstanding we only
+        // take budget that is free now: blocking here could wait on memory
+        // that only our own unread responses would release.
+        while (!choke.choked && next_request < piece_len && (int)outstanding.size() < max_in_flight) {
+            std::shared_ptr<ResourceLimit::Lease> lease;
+            if (!options.memory_limit) {
+                lease = std::make_shared<ResourceLimit::Lease>(nullptr, 0);
+            } else if (outstanding.empty()) {
+                lease = std::make_shared<ResourceLimit::Lease>(options.memory_limit, BLOCK_SIZE);
+            } else if (options.memory_limit->try_acquire(BLOCK_SIZE)) {
+                lease = std::make_shared<ResourceLimit::Lease>(options.memory_limit, BLOCK_SIZE, std::adopt_lock);
+            } else {
+                break;
+            }
+            int64_t req_len = std::min<int64_t>(BLOCK_SIZE, piece_len - next_request);
+            send_request(conn, piece_index, next_request, req_len);
+            outstanding.try_emplace(next_request, std::move(lease));
+            next_request += req_len;
+        }
+
+        // Wait for piece (id=7)
+        std::vector<uint8_t> message;
+        uint8_t id = recv_piece(conn, choke, message, on_other);
+        if (id == 0) {
+            for (auto& entry : outstanding) entry.second.requested = false;
+            continue;
+        }
+        if (id == 1) continue;
+        if (message.size() < 8) throw std::runtime_error("Malformed piece message");
+        uint32_t resp_index, resp_begin;
+        std::memcpy(&resp_index, message.data(), 4);
+        std::memcpy(&resp_begin, message.data() + 4, 4);
+        int64_t index = ntohl(resp_index);
+        int64_t begin = ntohl(resp_begin);
+        auto it = outstanding.find(begin);
+        if (index != piece_index || it == outstanding.end()) {
+            // A block requested twice around a choke can arrive after its
+            // first copy; pieces are fetched in order.
+            if (index < piece_index || (index == piece_index && begin < next_request && begin % BLOCK_SIZE == 0)) {
+                BT_LOG_DEBUG("peer", conn.stats().address << " sent block " << index << "/" << begin << " again");
+                continue;
+            }
+            throw std::runtime_error("Unexpected block " + std::to_string(index) + "/" + std::to_string(begin));
+        }
+        size_t len = message.size() - 8;
+        if (begin + (int64_t)len > piece_len) throw std::runtime_error("Block overruns piece");
+
+        uint64_t rtt = metrics::micros_since(it->second.sent_at);
+        BT_LOG_RATE_LIMITED(logging::Level::Debug, 10, "peer",
+                            "block " << piece_index << "/" << begin << " (" << len << " bytes) rtt "
+                                     << rtt << "us");
+        reg.request_rtt_us.record(rtt);
+        conn.stats().request_rtt_us.record(rtt);
+        conn.stats().blocks_received.fetch_add(1, std::memory_order_relaxed);
+        auto block = std::make_shared<const ReceivedBlock>(ReceivedBlock{std::move(message), std::move(it->second.lease)});
+        outstanding.erase(it);
+
+        // Write straight to disk.
+        auto done = writes.add();
+        reg.disk_queue_depth.fetch_add(1, std::memory_order_relaxed);
+        int64_t offset = file_offset + begin;
+        run_on(options.disk_pool, [fd, offset, block, done] {
+            try {
+                write_block(fd, offset, block->data(), block->size());
+                done->set_value();
+            } catch (...) {
+                done->set_exception(std::current_exception());
+            }
+            metrics::global().disk_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+        });
+        writes.reap_ready();
+
+        received += len;
+        reg.bytes_received.fetch_add(len, std::memory_order_relaxed);
+
+        if (verifier) {
+            // v2: every block is its own leaf, hashed as soon as it arrives.
+            verifier->push(block, block->data(), len, begin / BLOCK_SIZE);
+            int64_t bad = verifier->bad_block();
+            if (bad >= 0) reject_block(bad);
+        } else if (hasher) {
+            // v1: feed the SHA-1 in block order.
+            early[begin] = block;
+            for (auto e = early.begin(); e != early.end() && e->first == next_hash; e = early.erase(e)) {
+                hasher->push(e->second, e->second->data(), e->second->size());
+                next_hash += e->second->size();
+            }
+        }
+    }
+
+    if (verifier) {
+        bool ok = verifier->finish();
+        int64_t bad = verifier->bad_block();
+        if (bad >= 0) reject_block(bad);
+        if (!ok) {
+            reg.pieces_failed.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("Piece hash mismatch at index " + std::to_string(piece_index));
+        }
+        reg.pieces_verified.fetch_add(1, std::memory_order_relaxed);
+        BT_LOG_RATE_LIMITED(logging::Level::Debug, 10, "download", "piece " << piece_index << " verified (v2)");
+    } else if (hasher) {
+        std::string expected = t.info.pieces_hash_concat.substr(piece_index * 20, 20);
+        if (hasher->finish() != expected) {
+            reg.pieces_failed.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("Piece hash mismatch at index " + std::to_string(piece_index));
+        }
+        reg.pieces_verified.fetch_add(1, std::memory_order_relaxed);
+        BT_LOG_RATE_LIMITED(logging::Level::Debug, 10, "download", "piece " << piece_index << " verified");
+    }
+    if (verify != Verify::None) reg.bytes_verified.fetch_add(piece_len, std::memory_order_relaxed);
+    if (options.progress) options.progress->fetch_add(piece_len);
+}
+
+// The session proper: every piece in order, checked as `verify` says,
+// written to `fd`. Shared by live downloads and trace replay.
+static void download_all_pieces(wire::Connection& conn, const torrent::Torrent& t, int fd, Verify verify,
+                                const DownloadOptions& options) {
+    start_session(conn);
+    ChokeState choke;
+    metrics::global().bytes_total.fetch_add(t.info.length, std::memory_order_relaxed);
+
+    PendingWrites writes;
+    for (int64_t piece_index = 0; piece_index < t.info.num_pieces; ++piece_index) {
+        if (options.cancel && options.cancel->cancelled()) throw std::runtime_error("Download cancelled");
+        // v2 files start on piece boundaries, so pieces land at the same
+        // offsets in both layouts; padding stays a hole.
+        stream_piece(conn, choke, t, piece_index, fd, piece_index * t.info.piece_length, verify, options, writes);
+    }
+    writes.wait_all();
+}
+
+// Opens (and truncates) the output file for positional writes.
+static int open_output(const std::string& output_path) {
+    int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Failed to open output file");
+    return fd;
+}
+
+static std::string random_peer_id() {
     std::string peer_id(20, '\0');
     std::random_device rd;
     for (int i = 0; i < 20; ++i) peer_id[i] = static_cast<char>(rd() % 256);
-    auto peers = get_peers_from_tracker(t.announce_url, t.info_hash_raw, peer_id, t.info.length);
-    if (peers.empty()) throw std::runtime_error("No peers found");
+    return peer_id;
+}
 
-    // 3. Connect to first peer and handshake
+// Connects to `peer`, exchanges handshakes and returns the socket. For v2
+// torrents the v2 reserved bit is set and `verify` says whether the peer
+// answered with it too (and so serves hash requests). Every send and
+// receive on the socket, connect included, fails after `timeout_ms`.
+static int connect_to_peer(const Peer& peer, const torrent::Torrent& t, const std::string& peer_id,
+                           Verify& verify, int timeout_ms) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) throw std::runtime_error("Failed to create socket");
+    if (timeout_ms > 0) {
+        timeval tv{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(peers[0].port);
-    inet_pton(AF_INET, peers[0].ip.c_str(), &addr.sin_addr);
-    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) throw std::runtime_error("Connect failed");
+    addr.sin_port = htons(peer.port);
+    inet_pton(AF_INET, peer.ip.c_str(), &addr.sin_addr);
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        bool timed_out = errno == EINPROGRESS;
+        close(sock);
+        throw std::runtime_error(timed_out ? "Connect timed out" : "Connect failed");
+    }
 
     // Handshake
     std::string handshake;
     handshake += static_cast<char>(19);
     handshake += "BitTorrent protocol";
-    handshake += std::string(8, '\0');
+    std::string reserved(8, '\0');
+    if (t.info.has_v2) reserved[7] |= 0x10;
+    handshake += reserved;
     handshake += t.info_hash_raw;
     handshake += peer_id;
-    if (send(sock, handshake.data(), handshake.size(), 0) != 68) throw std::runtime_error("Handshake send failed");
     char recv_buf[68];
-    if (recv(sock, recv_buf, 68, MSG_WAITALL) != 68) throw std::runtime_error("Handshake recv failed");
+    if (send(sock, handshake.data(), handshake.size(), MSG_NOSIGNAL) != 68 ||
+        recv(sock, recv_buf, 68, MSG_WAITALL) != 68) {
+        close(sock);
+        throw std::runtime_error("Handshake failed");
+    }
+    verify = t.info.has_v2 && (recv_buf[27] & 0x10) ? Verify::Blocks : Verify::Pieces;
+    BT_LOG_INFO("peer", "connected to " << peer.ip << ":" << peer.port
+                                        << (verify == Verify::Blocks ? " (v2 per-block checks)" : ""));
+    return sock;
+}
 
-    // 4. Wait for bitfield (id=5)
-    uint8_t id;
-    recv_message(sock, id); // bitfield
-
-    // 5. Send interested (id=2)
-    send_message(sock, 2);
-
-    // 6. Wait for unchoke (id=1)
-    do { recv_message(sock, id); } while (id != 1);
-
-    // 7. Request blocks
-    int piece_len = (piece_index == t.info.num_pieces - 1)
-        ? t.info.length - (t.info.piece_length * (t.info.num_pieces - 1))
-        : t.info.piece_length;
-    std::vector<uint8_t> piece_data(piece_len);
-    int offset = 0;
-    while (offset < piece_len) {
-        int req_len = std::min(BLOCK_SIZE, piece_len - offset);
-        std::vector<uint8_t> payload(12);
-        uint32_t idx_n = htonl(piece_index);
-        uint32_t begin_n = htonl(offset);
-        uint32_t len_n = htonl(req_len);
-        std::memcpy(payload.data(), &idx_n, 4);
-        std::memcpy(payload.data() + 4, &begin_n, 4);
-        std::memcpy(payload.data() + 8, &len_n, 4);
-        send_message(sock, 6, payload);
+bool download_piece_to_file(
+    const std::string& torrent_path,
+    int64_t piece_index,
+    const std::string& output_path
+) {
+    // 1. Load torrent and get info
+    auto t = torrent::load_from_file(torrent_path);
+    piece_size(t, piece_index); // range check before touching the network
 
-        // Wait for piece (id=7)
-        do { payload = recv_message(sock, id); } while (id != 7);
-        int resp_idx = ntohl(*reinterpret_cast<uint32_t*>(payload.data()));
-        int resp_begin = ntohl(*reinterpret_cast<uint32_t*>(payload.data() + 4));
-        std::memcpy(piece_data.data() + resp_begin, payload.data() + 8, payload.size() - 8);
-        offset += req_len;
-    }
-    close(sock);
+    // 2. Get peers
+    std::string peer_id = random_peer_id();
+    auto peers = get_peers_from_tracker(t.announce_url, t.info_hash_raw, peer_id, t.info.length);
+    if (peers.empty()) throw std::runtime_error("No peers found");
+
+    // 3. Connect to first peer and handshake
+    Verify verify;
+    wire::SocketConnection conn(
+        connect_to_peer(peers[0], t, peer_id, verify, DownloadOptions{}.peer_timeout_ms),
+        metrics::global().peer(peers[0].ip + ":" + std::to_string(peers[0].port)));
+
+    // 4-6. Bitfield, interested, unchoke
+    start_session(conn);
 
-    // 8. Write to file
-    std::ofstream ofs(output_path, std::ios::binary);
-    ofs.write(reinterpret_cast<const char*>(piece_data.data()), piece_data.size());
+    // 7-8. Request blocks, writing each one at its offset in the output file
+    int fd = open_output(output_path);
+    try {
+        PendingWrites writes;
+        ChokeState choke;
+        stream_piece(conn, choke, t, piece_index, fd, 0, verify, {}, writes);
+        writes.wait_all();
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0) throw std::runtime_error("Failed to close output file");
     return true;
 }
 
 //downloaing the whole file piece by piece
 bool download_file(
     const std::string& torrent_path,
-    const std::string& output_path
+    const std::string& output_path,
+    const DownloadOptions& options
 ) {
     auto t = torrent::load_from_file(torrent_path);
+    return download_torrent(t, output_path, options);
+}
 
+bool download_torrent(
+    const torrent::Torrent& t,
+    const std::string& output_path,
+    const DownloadOptions& options
+) {
     // Generate peer_id
-    std::string peer_id(20, '\0');
-    std::random_device rd;
-    for (int i = 0; i < 20; ++i) peer_id[i] = static_cast<char>(rd() % 256);
+    std::string peer_id = random_peer_id();
 
     // Get peers
     auto peers = get_peers_from_tracker(t.announce_url, t.info_hash_raw, peer_id, t.info.length);
     if (peers.empty()) throw std::runtime_error("No peers found");
 
-    // Connect to first peer and handshake
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(peers[0].port);
-    inet_pton(AF_INET, peers[0].ip.c_str(), &addr.sin_addr);
-    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) throw std::runtime_error("Connect failed");
+    std::unique_ptr<trace::Writer> trace;
+    if (!options.trace_path.empty())
+        trace = std::make_unique<trace::Writer>(options.trace_path, t.info_hash_raw, options.trace_payloads);
 
-    // Handshake
-    std::string handshake;
-    handshake += static_cast<char>(19);
-    handshake += "BitTorrent protocol";
-    handshake += std::string(8, '\0');
-    handshake += t.info_hash_raw;
-    handshake += peer_id;
-    if (send(sock, handshake.data(), handshake.size(), 0) != 68) throw std::runtime_error("Handshake send failed");
-    char recv_buf[68];
-    if (recv(sock, recv_buf, 68, MSG_WAITALL) != 68) throw std::runtime_error("Handshake recv failed");
+    {
+        // Connect to first peer and handshake
+        ResourceLimit::Lease connection_slot(options.connection_limit, 1);
+        Verify verify;
+        wire::SocketConnection conn(
+            connect_to_peer(peers[0], t, peer_id, verify, options.peer_timeout_ms),
+            metrics::global().peer(peers[0].ip + ":" + std::to_string(peers[0].port)),
+            trace.get());
+        CancelToken::Watch interrupt(options.cancel, conn.fd());
 
-    // Wait for bitfield (id=5)
-    uint8_t id;
-    recv_message(sock, id); // bitfield
-
-    // Send interested (id=2)
-    send_message(sock, 2);
-
-    // Wait for unchoke (id=1)
-    do { recv_message(sock, id); } while (id != 1);
-
-    // Prepare output file
-    std::ofstream ofs(output_path, std::ios::binary);
-    if (!ofs) throw std::runtime_error("Failed to open output file");
-
-    // Download all pieces
-    for (int piece_index = 0; piece_index < t.info.num_pieces; ++piece_index) {
-        int piece_len = (piece_index == t.info.num_pieces - 1)
-            ? t.info.length - (t.info.piece_length * (t.info.num_pieces - 1))
-            : t.info.piece_length;
-        std::vector<uint8_t> piece_data(piece_len);
-        int offset = 0;
-        while (offset < piece_len) {
-            int req_len = std::min(BLOCK_SIZE, piece_len - offset);
-            std::vector<uint8_t> payload(12);
-            uint32_t idx_n = htonl(piece_index);
-            uint32_t begin_n = htonl(offset);
-            uint32_t len_n = htonl(req_len);
-            std::memcpy(payload.data(), &idx_n, 4);
-            std::memcpy(payload.data() + 4, &begin_n, 4);
-            std::memcpy(payload.data() + 8, &len_n, 4);
-            send_message(sock, 6, payload);
-
-            // Wait for piece (id=7)
-            do { payload = recv_message(sock, id); } while (id != 7);
-            int resp_idx = ntohl(*reinterpret_cast<uint32_t*>(payload.data()));
-            int resp_begin = ntohl(*reinterpret_cast<uint32_t*>(payload.data() + 4));
-            std::memcpy(piece_data.data() + resp_begin, payload.data() + 8, payload.size() - 8);
-            offset += req_len;
-        }
-        // Verify piece hash
-        std::string hash = utils::sha1_hash(std::string(reinterpret_cast<char*>(piece_data.data()), piece_data.size()));
-        std::string expected = t.info.pieces_hash_concat.substr(piece_index * 20, 20);
-        if (hash != expected) throw std::runtime_error("Piece hash mismatch at index " + std::to_string(piece_index));
-        ofs.write(reinterpret_cast<const char*>(piece_data.data()), piece_data.size());
+        // Prepare output file
+        int fd = open_output(output_path);
+        try {
+            download_all_pieces(conn, t, fd, verify, options);
+        } catch (...) {
+            close(fd);
+            // A cancelled session usually fails on its shut-down socket; say why.
+            if (options.cancel && options.cancel->cancelled()) throw std::runtime_error("Download cancelled");
+            throw;
+        }
+        if (close(fd) != 0) throw std::runtime_error("Failed to close output file");
     }
-    close(sock);
-    ofs.close();
+    // The connection has logged its close record by now.
+    if (trace) trace->finish();
     return true;
-}
\ No newline at end of file
+}
+
+bool replay_download(
+    const std::string& trace_path,
+    const std::string& torrent_path,
+    const std::string& output_path,
+    const ReplayOptions& options
+) {
+    auto t = torrent::load_from_file(torrent_path);
+    trace::Trace recorded = trace::read_file(trace_path);
+    if (recorded.info_hash != t.info_hash_raw)
+        throw std::runtime_error("Trace was recorded for a different torrent");
+
+    std::string address = "replay";
+    for (const auto& r : recorded.records) {
+        if (r.kind == trace::Kind::Open && r.conn_id == options.conn_id) {
+            address = "replay:" + std::string(reinterpret_cast<const char*>(r.data), r.size);
+            break;
+        }
+    }
+    wire::ReplayConnection conn(recorded, options.conn_id, options.speed, metrics::global().peer(address));
+    BT_LOG_INFO("replay", "replaying connection " << options.conn_id << " (" << address << ") at speed "
+                                                  << options.speed);
+
+    // Blocks recorded without payload replay as zeros and cannot be hash-checked.
+    // Recorded hashes replies arrive at their recorded time, so v2 pieces
+    // may fall back to whole-piece checks.
+    Verify verify = !recorded.has_payloads() ? Verify::None : t.info.has_v2 ? Verify::Blocks : Verify::Pieces;
+    DownloadOptions session;
+    session.max_in_flight = options.max_in_flight;
+    int fd = open_output(output_path);
+    try {
+        download_all_pieces(conn, t, fd, verify, session);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0) throw std::runtime_error("Failed to close output file");
+    return true;
+}
@@ -0,0 +1,332 @@
+#include "service.h"
+#include "bencode.h"
+#include "log.h"
+#include "metrics.h"
+#include "piece_downloader.h"
+#include "utils.h"
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace service {
+
+    static std::atomic<bool> g_signalled{false};
+
+    static void on_signal(int) {
+        g_signalled = true;
+    }
+
+    // Helper: fill a sockaddr_un, rejecting paths that do not fit.
+    static sockaddr_un unix_address(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+
+    static json error_reply(const std::string& message) {
+        return json{{"ok", false}, {"error", message}};
+    }
+
+    Daemon::Daemon(Config config)
+        : config_(std::move(config)),
+          connections_(config_.max_connections),
+          memory_(config_.memory_limit),
+          hash_pool_(config_.hash_threads ? config_.hash_threads : std::max(1u, std::thread::hardware_concurrency())),
+          disk_pool_(config_.disk_threads),
+          sessions_(config_.max_active) {
+        if (!config_.state_dir.empty()) {
+            fs::create_directories(config_.state_dir);
+            load_cache();
+        }
+    }
+
+    Daemon::~Daemon() {
+        // Interrupt running downloads (their peer sockets are shut down);
+        // queued ones see the flag and return immediately when sessions_ drains.
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [hash, job] : jobs_) job->cancel.cancel();
+    }
+
+    const char* Daemon::state_name(State s) {
+        switch (s) {
+            case State::Queued: return "queued";
+            case State::Running: return "running";
+            case State::Done: return "done";
+            case State::Failed: return "failed";
+        }
+        return "unknown";
+    }
+
+    std::string Daemon::cache_path(const std::string& info_hash_hex) const {
+        return (fs::path(config_.state_dir) / (info_hash_hex + ".meta")).string();
+    }
+
+    void Daemon::save_cache(const Job& job) {
+        if (config_.state_dir.empty()) return;
+        json entry{
+            {"torrent", job.meta.to_json()},
+            {"output", job.output_path},
+            {"state", job.state == State::Done ? "done" : "queued"}};
+        std::string data = bencode::encode(entry);
+        // Under mutex_, so a concurrent remove() either deletes the file
+        // after us or has already cancelled the job and we skip it.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (job.cancel.cancelled()) return;
+        std::string path = cache_path(job.meta.info_hash_hex);
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+            ofs << data;
+            if (!ofs) throw std::runtime_error("Failed to write cache file: " + tmp);
+        }
+        fs::rename(tmp, path);
+    }
+
+    void Daemon::load_cache() {
+        for (const auto& entry : fs::directory_iterator(config_.state_dir)) {
+            if (entry.path().extension() != ".meta") continue;
+            try {
+                json cached = bencode::decode(utils::read_file_as_binary_string(entry.path().string()));
+                auto job = std::make_shared<Job>();
+                job->meta = torrent::Torrent::from_json(cached.at("torrent"));
+                job->output_path = cached.at("output").get<std::string>();
+                bool done = cached.at("state").get<std::string>() == "done";
+                jobs_[job->meta.info_hash_hex] = job;
+                if (done) {
+                    job->state = State::Done;
+                    job->bytes_done = job->meta.info.length;
+                } else {
+                    enqueue(job);
+                }
+            } catch (const std::exception& e) {
+                BT_LOG_WARN("daemon", "skipping unreadable cache entry " << entry.path() << ": " << e.what());
+            }
+        }
+    }
+
+    void Daemon::enqueue(const std::shared_ptr<Job>& job) {
+        sessions_.post([this, job] { run_job(job); });
+    }
+
+    void Daemon::run_job(const std::shared_ptr<Job>& job) {
+        if (job->cancel.cancelled()) return;
+        job->state = State::Running;
+        job->bytes_done = 0;
+        BT_LOG_INFO("daemon", "starting " << job->meta.info_hash_hex << " (" << job->meta.info.name << ")");
+
+        DownloadOptions options;
+        options.hash_pool = &hash_pool_;
+        options.disk_pool = &disk_pool_;
+        options.connection_limit = &connections_;
+        options.memory_limit = &memory_;
+        options.peer_timeout_ms = config_.peer_timeout_ms;
+        options.cancel = &job->cancel;
+        options.progress = &job->bytes_done;
+        try {
+            download_torrent(job->meta, job->output_path, options);
+            job->state = State::Done;
+            save_cache(*job);
+            BT_LOG_INFO("daemon", "finished " << job->meta.info_hash_hex);
+        } catch (const std::exception& e) {
+            if (job->cancel.cancelled()) BT_LOG_INFO("daemon", "cancelled " << job->meta.info_hash_hex);
+            else BT_LOG_WARN("daemon", "job " << job->meta.info_hash_hex << " failed: " << e.what());
+            std::lock_guard<std::mutex> lock(mutex_);
+            job->error = e.what();
+            job->state = State::Failed;
+        }
+    }
+
+    json Daemon::add(const std::string& torrent_path, const std::string& output_path) {
+        // The daemon's working directory is not the client's, so a relative
+        // path would silently name a different file.
+        if (!fs::path(torrent_path).is_absolute() || !fs::path(output_path).is_absolute())
+            return error_reply("add needs absolute paths");
+        auto job = std::make_shared<Job>();
+        job->meta = torrent::load_from_file(torrent_path);
+        job->output_path = output_path;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (jobs_.count(job->meta.info_hash_hex))
+                return error_reply("Torrent already added: " + job->meta.info_hash_hex);
+            jobs_[job->meta.info_hash_hex] = job;
+        }
+        save_cache(*job);
+        enqueue(job);
+        return json{{"ok", true}, {"info_hash", job->meta.info_hash_hex}};
+    }
+
+    json Daemon::remove(const std::string& info_hash_hex) {
+        std::shared_ptr<Job> job;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = jobs_.find(info_hash_hex);
+            if (it == jobs_.end()) return error_reply("Unknown torrent: " + info_hash_hex);
+            job = it->second;
+            jobs_.erase(it);
+            job->cancel.cancel();
+            if (!config_.state_dir.empty()) fs::remove(cache_path(info_hash_hex));
+        }
+        return json{{"ok", true}};
+    }
+
+    json Daemon::status() {
+        json jobs = json::array();
+        int running = 0, queued = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& [hash, job] : jobs_) {
+                State s = job->state;
+                running += s == State::Running;
+                queued += s == State::Queued;
+                json j{
+                    {"info_hash", hash},
+                    {"name", job->meta.info.name},
+                    {"state", state_name(s)},
+                    {"bytes_done", job->bytes_done.load()},
+                    {"length", job->meta.info.length},
+                    {"output", job->output_path}};
+                if (!job->error.empty()) j["error"] = job->error;
+                jobs.push_back(std::move(j));
+            }
+        }
+        json m = metrics::global().snapshot();
+        m.erase("peers"); // one entry per live connection; too large for a status line
+        return json{
+            {"ok", true},
+            {"running", running},
+            {"queued", queued},
+            {"connections_in_use", connections_.in_use()},
+            {"memory_in_use", memory_.in_use()},
+            {"hash_queue", hash_pool_.queued()},
+            {"disk_queue", disk_pool_.queued()},
+            {"jobs", jobs},
+            {"metrics", m}};
+    }
+
+    json Daemon::handle_command(const std::string& line) {
+        try {
+            json request = json::parse(line);
+            if (!request.is_object()) return error_reply("request must be a JSON object");
+            std::string cmd = request.value("cmd", "");
+            if (cmd == "add") {
+                std::string torrent_path = request.value("torrent", "");
+                std::string output_path = request.value("output", "");
+                if (torrent_path.empty() || output_path.empty())
+                    return error_reply("usage: {\"cmd\":\"add\",\"torrent\":<path>,\"output\":<path>}");
+                return add(torrent_path, output_path);
+            } else if (cmd == "remove") {
+                std::string hash = request.value("info_hash", "");
+                if (hash.empty()) return error_reply("usage: {\"cmd\":\"remove\",\"info_hash\":<hex>}");
+                return remove(hash);
+            } else if (cmd == "status") {
+                return status();
+            } else if (cmd == "shutdown") {
+                stopping_ = true;
+                return json{{"ok", true}};
+            }
+            return error_reply("unknown command: " + cmd);
+        } catch (const std::exception& e) {
+            return error_reply(e.what());
+        }
+    }
+
+    // A single poll() loop multiplexes the listening socket and every
+    // control client; commands are cheap, downloads run on the pools.
+    void Daemon::run() {
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) throw std::runtime_error("Failed to create control socket");
+        sockaddr_un addr = unix_address(config_.socket_path);
+        unlink(config_.socket_path.c_str());
+        if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+            close(listen_fd);
+            throw std::runtime_error("Failed to listen on " + config_.socket_path);
+        }
+        BT_LOG_INFO("daemon", "listening on " << config_.socket_path);
+
+        struct Client {
+            int fd;
+            std::string buffer;
+        };
+        std::vector<Client> clients;
+
+        while (!stopping_ && !g_signalled) {
+            std::vector<pollfd> fds{{listen_fd, POLLIN, 0}};
+            for (const auto& c : clients) fds.push_back({c.fd, POLLIN, 0});
+            if (poll(fds.data(), fds.size(), 250) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd >= 0) clients.push_back({fd, {}});
+            }
+
+            for (size_t i = 1; i < fds.size(); ++i) {
+                if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                Client& c = clients[i - 1];
+                char buf[4096];
+                ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    close(c.fd);
+                    c.fd = -1;
+                    continue;
+                }
+                c.buffer.append(buf, n);
+                size_t nl;
+                while ((nl = c.buffer.find('\n')) != std::string::npos) {
+                    BT_LOG_DEBUG("daemon", "command: " << c.buffer.substr(0, nl));
+                    std::string reply = handle_command(c.buffer.substr(0, nl)).dump() + "\n";
+                    c.buffer.erase(0, nl + 1);
+                    send(c.fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+                }
+            }
+            std::erase_if(clients, [](const Client& c) { return c.fd < 0; });
+        }
+
+        for (const auto& c : clients) close(c.fd);
+        close(listen_fd);
+        unlink(config_.socket_path.c_str());
+    }
+
+    std::string send_command(const std::string& socket_path, const std::string& command) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("Failed to create socket");
+        sockaddr_un addr = unix_address(socket_path);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            throw std::runtime_error("Failed to connect to daemon at " + socket_path);
+        }
+        std::string line = command + "\n";
+        send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+
+        std::string reply;
+        char buf[4096];
+        while (reply.find('\n') == std::string::npos) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            reply.append(buf, n);
+        }
+        close(fd);
+        if (!reply.empty() && reply.back() == '\n') reply.pop_back();
+        return reply;
+    }
+
+} // namespace service
@@ -1,20 +1,229 @@
 #include "torrent.h"
 #include "utils.h"   // We use our utils for file reading and hashing
 #include "bencode.h" // And our bencode module for decoding
-#include <iostream>
+#include "log.h"
+#include "merkle.h"
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 
 namespace torrent
 {
 
+    namespace
+    {
+        // Flattens a v2 file tree depth-first in key order (the order files
+        // are laid out in), starting every non-empty file on a piece boundary.
+        void walk_file_tree(const json &node, const std::string &prefix, int64_t piece_length,
+                            std::vector<FileV2> &files, int64_t &offset)
+        {
+            if (!node.is_object())
+            {
+                throw std::runtime_error("Invalid file tree entry: " + prefix);
+            }
+            for (const auto &entry : node.items())
+            {
+                if (!entry.key().empty())
+                {
+                    std::string path = prefix.empty() ? entry.key() : prefix + "/" + entry.key();
+                    walk_file_tree(entry.value(), path, piece_length, files, offset);
+                    continue;
+                }
+                FileV2 f;
+                f.path = prefix;
+                f.length = entry.value().at("length").get<int64_t>();
+                f.offset = offset;
+                if (f.length > 0)
+                {
+                    f.pieces_root = entry.value().at("pieces root").get<std::string>();
+                    if (f.pieces_root.size() != merkle::HASH_SIZE)
+                    {
+                        throw std::runtime_error("Invalid pieces root for " + f.path);
+                    }
+                    offset += (f.length + piece_length - 1) / piece_length * piece_length;
+                }
+                files.push_back(std::move(f));
+            }
+        }
+
+        // Fills the v2 fields of `info` from the info dictionary and the
+        // top-level "piece layers". With `verify_layers` every layer is
+        // hashed up and checked against its root; without it (layers that
+        // were checked before being cached) only their sizes are.
+        void parse_v2(const json &info_json, const json &layers_json, Info &info, bool verify_layers)
+        {
+            if (info_json.at("meta version").get<int64_t>() != 2)
+            {
+                throw std::runtime_error("Unsupported meta version");
+            }
+            int64_t pl = info.piece_length;
+            if (pl < merkle::LEAF_SIZE || merkle::next_pow2(pl) != pl)
+            {
+                throw std::runtime_error("v2 piece length must be a power of two >= 16 KiB");
+            }
+
+            info.has_v2 = true;
+            int64_t offset = 0;
+            walk_file_tree(info_json.at("file tree"), "", pl, info.files_v2, offset);
+
+            int64_t end = 0;
+            int64_t pieces = 0;
+            const std::string pad = verify_layers ? merkle::pad_hash(pl / merkle::LEAF_SIZE) : std::string();
+            for (const auto &f : info.files_v2)
+            {
+                if (f.length == 0)
+                {
+                    continue;
+                }
+                end = f.offset + f.length;
+                int64_t file_pieces = (f.length + pl - 1) / pl;
+                pieces += file_pieces;
+                if (f.length <= pl)
+                {
+                    continue; // the pieces root is the only hash
+                }
+                if (!layers_json.is_object() || !layers_json.contains(f.pieces_root))
+                {
+                    throw std::runtime_error("Missing piece layer for " + f.path);
+                }
+                std::string layer = layers_json.at(f.pieces_root).get<std::string>();
+                if ((int64_t)layer.size() != file_pieces * (int64_t)merkle::HASH_SIZE ||
+                    (verify_layers && merkle::root(layer, merkle::next_pow2(file_pieces), pad) != f.pieces_root))
+                {
+                    throw std::runtime_error("Piece layer does not match pieces root for " + f.path);
+                }
+                info.piece_layers[f.pieces_root] = std::move(layer);
+            }
+
+            if (!info.has_v1)
+            {
+                info.length = end;
+                info.num_pieces = pieces;
+            }
+            else if (info.num_pieces != pieces)
+            {
+                throw std::runtime_error("Hybrid torrent: v1 and v2 piece counts differ");
+            }
+        }
+    } // namespace
+
+    json file_tree(const std::vector<FileV2> &files)
+    {
+        json tree = json::object();
+        for (const auto &f : files)
+        {
+            json *node = &tree;
+            size_t start = 0;
+            for (;;)
+            {
+                size_t slash = f.path.find('/', start);
+                node = &(*node)[f.path.substr(start, slash - start)];
+                if (slash == std::string::npos)
+                {
+                    break;
+                }
+                start = slash + 1;
+            }
+            json leaf{{"length", f.length}};
+            if (f.length > 0)
+            {
+                leaf["pieces root"] = f.pieces_root;
+            }
+            (*node)[""] = std::move(leaf);
+        }
+        return tree;
+    }
+
     json Info::to_json() const
     {
-        return json{
+        json j{
             {"name", this->name},
             {"length", this->length},
             {"piece length", this->piece_length},
             {"pieces", this->pieces_hash_concat}};
+        if (this->has_v2)
+        {
+            j["meta version"] = 2;
+            j["file tree"] = file_tree(this->files_v2);
+        }
+        return j;
+    }
+
+    json Torrent::to_json() const
+    {
+        json j{
+            {"announce", this->announce_url},
+            {"info", this->info.to_json()},
+            {"info hash", this->info_hash_raw}};
+        if (this->info.has_v2)
+        {
+            j["info hash v2"] = this->info_hash_v2;
+            j["piece layers"] = json::object();
+            for (const auto &[root, layer] : this->info.piece_layers)
+            {
+                j["piece layers"][root] = layer;
+            }
+        }
+        return j;
+    }
+
+    PieceV2 locate_piece_v2(const Info &info, int64_t piece_index)
+    {
+        int64_t begin = piece_index * info.piece_length;
+        // Last file starting at or before `begin`; empty files sharing that
+        // offset come first, so this lands on the one holding the data.
+        auto it = std::upper_bound(info.files_v2.begin(), info.files_v2.end(), begin,
+                                   [](int64_t pos, const FileV2 &f)
+                                   { return pos < f.offset; });
+        if (piece_index < 0 || it == info.files_v2.begin() || begin >= std::prev(it)->offset + std::prev(it)->length)
+        {
+            throw std::runtime_error("Piece index out of range: " + std::to_string(piece_index));
+        }
+        const FileV2 &f = *std::prev(it);
+
+        PieceV2 p;
+        p.file = &f;
+        p.index_in_file = (begin - f.offset) / info.piece_length;
+        p.size = std::min(info.piece_length, f.offset + f.length - begin);
+        if (f.length <= info.piece_length)
+        {
+            p.hash = f.pieces_root;
+            p.leaf_count = merkle::next_pow2(merkle::num_leaves(f.length));
+        }
+        else
+        {
+            p.hash = info.piece_layers.at(f.pieces_root).substr(p.index_in_file * merkle::HASH_SIZE, merkle::HASH_SIZE);
+            p.leaf_count = info.piece_length / merkle::LEAF_SIZE;
+        }
+        return p;
+    }
+
+    Torrent Torrent::from_json(const json &j)
+    {
+        Torrent t;
+        t.announce_url = j.at("announce").get<std::string>();
+        const json &info_json = j.at("info");
+        t.info.name = info_json.at("name").get<std::string>();
+        t.info.length = info_json.at("length").get<int64_t>();
+        t.info.piece_length = info_json.at("piece length").get<int64_t>();
+        t.info.pieces_hash_concat = info_json.at("pieces").get<std::string>();
+        t.info.num_pieces = t.info.pieces_hash_concat.size() / 20;
+        t.info.has_v1 = !t.info.pieces_hash_concat.empty();
+        if (info_json.contains("meta version"))
+        {
+            // Cached layers were verified when the torrent was first loaded.
+            parse_v2(info_json, j.at("piece layers"), t.info, false);
+            t.info_hash_v2 = j.at("info hash v2").get<std::string>();
+        }
+        t.info_hash_raw = j.at("info hash").get<std::string>();
+        if (t.info_hash_raw.size() != 20)
+        {
+            throw std::runtime_error("Invalid cached torrent: bad info hash");
+        }
+        t.info_hash_hex = utils::to_hex(
+            reinterpret_cast<const unsigned char *>(t.info_hash_raw.data()),
+            t.info_hash_raw.length());
+        return t;
     }
 
     Torrent load_from_file(const std::string &filename)
@@ -33,8 +242,16 @@ namespace torrent
         const json &info_json = torrent_json.at("info");
         t.info.name = info_json.at("name").get<std::string>();
 
+        t.info.piece_length = info_json.at("piece length").get<int64_t>();
+        t.info.has_v1 = info_json.contains("pieces");
+
         // Handle both single-file and multi-file torrents
-        if (info_json.contains("length"))
+        if (!t.info.has_v1)
+        {
+            // v2-only: the length comes from the file tree
+            t.info.length = 0;
+        }
+        else if (info_json.contains("length"))
         {
             t.info.length = info_json.at("length").get<int64_t>();
         }
@@ -53,18 +270,34 @@ namespace torrent
         }
 
         //t.info.length = info_json.at("length").get<int64_t>();
-        t.info.piece_length = info_json.at("piece length").get<int64_t>();
-        t.info.pieces_hash_concat = info_json.at("pieces").get<std::string>();
-        t.info.num_pieces = t.info.pieces_hash_concat.size() / 20;
-
-        std::cout << "Number of pieces: " << t.info.num_pieces << std::endl;
+        if (t.info.has_v1)
+        {
+            t.info.pieces_hash_concat = info_json.at("pieces").get<std::string>();
+            t.info.num_pieces = t.info.pieces_hash_concat.size() / 20;
+        }
+        if (info_json.contains("meta version"))
+        {
+            // Piece layers live next to "info", not inside it.
+            json no_layers;
+            parse_v2(info_json, torrent_json.contains("piece layers") ? torrent_json.at("piece layers") : no_layers, t.info, true);
+        }
+        else if (!t.info.has_v1)
+        {
+            throw std::runtime_error("No pieces in torrent info");
+        }
 
         // Calculate the info hash
         std::string bencoded_info = bencode::encode(info_json);
-        t.info_hash_raw = utils::sha1_hash(bencoded_info);
+        if (t.info.has_v2)
+        {
+            t.info_hash_v2 = utils::sha256_hash(bencoded_info);
+        }
+        t.info_hash_raw = t.info.has_v1 ? utils::sha1_hash(bencoded_info) : t.info_hash_v2.substr(0, 20);
         t.info_hash_hex = utils::to_hex(
             reinterpret_cast<const unsigned char *>(t.info_hash_raw.data()),
             t.info_hash_raw.length());
+        BT_LOG_DEBUG("torrent", "loaded " << filename << ": " << t.info.num_pieces << " pieces"
+                                          << (t.info.has_v2 ? (t.info.has_v1 ? ", hybrid" : ", v2") : ""));
 
         return t;
     }
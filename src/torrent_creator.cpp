@@ -0,0 +1,382 @@
+#include "torrent_creator.h"
+#include "bencode.h"
+#include "merkle.h"
+#include "torrent.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace torrent
+{
+
+    namespace
+    {
+        // One input file and where it sits in the concatenated payload.
+        struct InputFile
+        {
+            fs::path disk_path;
+            std::vector<std::string> path; // components relative to the torrent root
+            int64_t length = 0;
+            int64_t offset = 0; // position of the first byte in the concatenated payload
+        };
+
+        // A read-only mapping of one whole file.
+        struct Mapping
+        {
+            size_t file = 0; // index into the input file list
+            int64_t length = 0;
+            const unsigned char *data = nullptr;
+
+            Mapping() = default;
+            Mapping(const Mapping &) = delete;
+            Mapping &operator=(const Mapping &) = delete;
+            Mapping(Mapping &&other) noexcept
+                : file(other.file), length(other.length), data(other.data)
+            {
+                other.data = nullptr;
+            }
+            Mapping &operator=(Mapping &&other) noexcept
+            {
+                std::swap(file, other.file);
+                std::swap(length, other.length);
+                std::swap(data, other.data);
+                return *this;
+            }
+
+            ~Mapping()
+            {
+                if (data)
+                    munmap(const_cast<unsigned char *>(data), length);
+            }
+
+            void map(size_t index, const InputFile &f)
+            {
+                file = index;
+                length = f.length;
+                int fd = open(f.disk_path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::runtime_error("Failed to open file: " + f.disk_path.string());
+                void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (p == MAP_FAILED)
+                    throw std::runtime_error("Failed to map file: " + f.disk_path.string());
+                // Each worker walks its pieces front to back, so ask for readahead.
+                madvise(p, length, MADV_SEQUENTIAL);
+                data = static_cast<const unsigned char *>(p);
+            }
+        };
+
+        // Per-worker LRU of open mappings. Files are mapped only while their
+        // pieces are being hashed, so the number of live mappings stays at
+        // threads * CAPACITY however many files the tree holds (each mapping
+        // is a VMA, and vm.max_map_count caps those per process).
+        class MappingCache
+        {
+        public:
+            static constexpr size_t CAPACITY = 8;
+
+            explicit MappingCache(const std::vector<InputFile> &files) : files_(files) {}
+
+            // Non-empty file `index`, mapped; valid until CAPACITY other files are used.
+            const unsigned char *data(size_t index)
+            {
+                auto it = std::find_if(entries_.begin(), entries_.end(),
+                                       [&](const Mapping &m)
+                                       { return m.file == index; });
+                if (it == entries_.end())
+                {
+                    if (entries_.size() == CAPACITY)
+                        entries_.pop_back();
+                    Mapping m;
+                    m.map(index, files_[index]);
+                    entries_.insert(entries_.begin(), std::move(m));
+                }
+                else
+                {
+                    std::rotate(entries_.begin(), it, it + 1);
+                }
+                return entries_.front().data;
+            }
+
+        private:
+            const std::vector<InputFile> &files_;
+            std::vector<Mapping> entries_; // most recently used first
+        };
+
+        // Hashes v1 piece `index`, feeding every file span it covers. Gaps
+        // between piece-aligned files (hybrid pad files) hash as zeros.
+        std::string hash_piece(const std::vector<InputFile> &files, MappingCache &maps, int64_t index,
+                               int64_t piece_length, int64_t total_length, utils::Sha1 &sha)
+        {
+            static const std::vector<unsigned char> zeros(64 * 1024);
+            int64_t begin = index * piece_length;
+            int64_t end = std::min(begin + piece_length, total_length);
+
+            // First file whose range ends after `begin`.
+            auto it = std::upper_bound(files.begin(), files.end(), begin,
+                                       [](int64_t pos, const InputFile &f)
+                                       { return pos < f.offset + f.length; });
+            for (int64_t pos = begin; pos < end;)
+            {
+                if (it == files.end())
+                    throw std::runtime_error("Piece extends past end of payload");
+                if (pos < it->offset)
+                {
+                    int64_t gap_end = std::min(end, it->offset);
+                    for (; pos < gap_end; pos += std::min<int64_t>(gap_end - pos, zeros.size()))
+                        sha.update(zeros.data(), std::min<int64_t>(gap_end - pos, zeros.size()));
+                    continue;
+                }
+                int64_t file_end = it->offset + it->length;
+                int64_t span_end = std::min(end, file_end);
+                if (span_end > pos)
+                    sha.update(maps.data(it - files.begin()) + (pos - it->offset), span_end - pos);
+                pos = std::max(pos, span_end);
+                ++it;
+            }
+            return sha.finish();
+        }
+
+        // v2 hash of the `index_in_file`-th piece of `f`: the Merkle root of
+        // its 16 KiB leaves, padded to a full piece (or, for a file of one
+        // piece, to the next power of two, which makes it the pieces root).
+        std::string hash_piece_v2(const InputFile &f, const unsigned char *data, int64_t index_in_file,
+                                  int64_t piece_length, utils::Sha256 &sha)
+        {
+            int64_t begin = index_in_file * piece_length;
+            int64_t end = std::min(begin + piece_length, f.length);
+            std::string leaves;
+            for (int64_t pos = begin; pos < end; pos += merkle::LEAF_SIZE)
+            {
+                sha.update(data + pos, std::min(merkle::LEAF_SIZE, end - pos));
+                leaves += sha.finish();
+            }
+            int64_t width = f.length <= piece_length ? merkle::next_pow2(merkle::num_leaves(f.length))
+                                                     : piece_length / merkle::LEAF_SIZE;
+            return merkle::root(leaves, width);
+        }
+    } // namespace
+
+    int64_t auto_piece_length(int64_t total_length)
+    {
+        constexpr int64_t MIN_PIECE = 16 * 1024;
+        constexpr int64_t MAX_PIECE = 16 * 1024 * 1024;
+        constexpr int64_t TARGET_PIECES = 2000;
+        int64_t piece_length = MIN_PIECE;
+        while (piece_length < MAX_PIECE && total_length / piece_length > TARGET_PIECES)
+            piece_length *= 2;
+        return piece_length;
+    }
+
+    std::string create_torrent(const std::string &input_path,
+                               const std::string &output_path,
+                               const CreateOptions &options)
+    {
+        // load_from_file() requires an announce URL, so never write a torrent without one.
+        if (options.announce_url.empty())
+            throw std::runtime_error("An announce URL is required");
+        fs::path root = fs::absolute(input_path).lexically_normal();
+        if (root.filename().empty())
+            root = root.parent_path(); // "dir/" -> "dir"
+        if (!fs::exists(root))
+            throw std::runtime_error("No such file or directory: " + input_path);
+
+        // Collect files in a stable order so the same tree always yields the same torrent.
+        std::vector<fs::path> disk_paths;
+        bool single_file = fs::is_regular_file(root);
+        if (single_file)
+        {
+            disk_paths.push_back(root);
+        }
+        else
+        {
+            for (const auto &entry : fs::recursive_directory_iterator(root))
+            {
+                if (entry.is_regular_file())
+                    disk_paths.push_back(entry.path());
+            }
+            std::sort(disk_paths.begin(), disk_paths.end());
+            if (disk_paths.empty())
+                throw std::runtime_error("Directory contains no files: " + input_path);
+        }
+
+        const bool v1 = options.format != Format::V2;
+        const bool v2 = options.format != Format::V1;
+
+        std::vector<InputFile> files;
+        int64_t content_length = 0;
+        for (const auto &p : disk_paths)
+        {
+            InputFile f;
+            f.disk_path = p;
+            for (const auto &part : p.lexically_relative(root))
+                f.path.push_back(part.string());
+            f.length = static_cast<int64_t>(fs::file_size(p));
+            content_length += f.length;
+            files.push_back(std::move(f));
+        }
+        if (content_length == 0)
+            throw std::runtime_error("Cannot create a torrent for empty content");
+
+        int64_t piece_length = options.piece_length > 0 ? options.piece_length : auto_piece_length(content_length);
+        if (v2 && (piece_length < merkle::LEAF_SIZE || merkle::next_pow2(piece_length) != piece_length))
+            throw std::runtime_error("v2 piece length must be a power of two >= 16 KiB");
+
+        // Lay the files out: back to back for v1, each on a piece boundary
+        // for v2. `piece_file` maps every piece to the file holding it.
+        int64_t total_length = 0;
+        std::vector<size_t> piece_file;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (v2 && files[i].length > 0)
+                total_length = (total_length + piece_length - 1) / piece_length * piece_length;
+            files[i].offset = total_length;
+            total_length += files[i].length;
+            if (v2)
+                piece_file.insert(piece_file.end(), (files[i].length + piece_length - 1) / piece_length, i);
+        }
+
+        int64_t num_pieces = (total_length + piece_length - 1) / piece_length;
+        std::string pieces(v1 ? num_pieces * 20 : 0, '\0');
+        std::string pieces_v2(v2 ? num_pieces * merkle::HASH_SIZE : 0, '\0');
+
+        // Workers claim small batches of consecutive pieces so each one
+        // reads sequentially and the page cache readahead stays effective.
+        unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        int64_t batch = std::max<int64_t>(1, (4 * 1024 * 1024) / piece_length);
+        std::atomic<int64_t> next{0};
+        std::vector<std::thread> workers;
+        std::vector<std::exception_ptr> errors(threads);
+        for (unsigned w = 0; w < threads; ++w)
+        {
+            workers.emplace_back([&, w]
+                                 {
+                try {
+                    utils::Sha1 sha;
+                    utils::Sha256 sha256;
+                    MappingCache maps(files);
+                    for (;;) {
+                        int64_t first = next.fetch_add(batch);
+                        if (first >= num_pieces) break;
+                        int64_t last = std::min(first + batch, num_pieces);
+                        for (int64_t i = first; i < last; ++i) {
+                            if (v1) {
+                                std::string h = hash_piece(files, maps, i, piece_length, total_length, sha);
+                                std::copy(h.begin(), h.end(), pieces.begin() + i * 20);
+                            }
+                            if (v2) {
+                                const InputFile &f = files[piece_file[i]];
+                                std::string h = hash_piece_v2(f, maps.data(piece_file[i]),
+                                                              (i * piece_length - f.offset) / piece_length,
+                                                              piece_length, sha256);
+                                std::copy(h.begin(), h.end(), pieces_v2.begin() + i * merkle::HASH_SIZE);
+                            }
+                        }
+                    }
+                } catch (...) {
+                    errors[w] = std::current_exception();
+                } });
+        }
+        for (auto &t : workers)
+            t.join();
+        for (auto &e : errors)
+        {
+            if (e)
+                std::rethrow_exception(e);
+        }
+
+        json info{
+            {"name", root.filename().string()},
+            {"piece length", piece_length}};
+        if (v1)
+        {
+            info["pieces"] = std::move(pieces);
+            if (single_file)
+            {
+                info["length"] = total_length;
+            }
+            else
+            {
+                // Hybrid: pad files fill the gaps so v1 pieces line up with v2.
+                json file_list = json::array();
+                int64_t pos = 0;
+                for (const auto &f : files)
+                {
+                    int64_t gap = f.offset - pos;
+                    if (gap > 0)
+                        file_list.push_back(json{{"attr", "p"}, {"length", gap}, {"path", {".pad", std::to_string(gap)}}});
+                    file_list.push_back(json{{"length", f.length}, {"path", f.path}});
+                    pos = f.offset + f.length;
+                }
+                info["files"] = std::move(file_list);
+            }
+        }
+
+        // Per file: its slice of the v2 piece hashes is the piece layer, and
+        // the root over that layer is the pieces root.
+        json piece_layers = json::object();
+        if (v2)
+        {
+            const std::string pad = merkle::pad_hash(piece_length / merkle::LEAF_SIZE);
+            std::vector<FileV2> tree;
+            for (const auto &f : files)
+            {
+                FileV2 entry{single_file ? root.filename().string() : std::string(), f.length, f.offset, {}};
+                for (const auto &part : f.path)
+                {
+                    if (!single_file)
+                        entry.path += (entry.path.empty() ? "" : "/") + part;
+                }
+                int64_t file_pieces = (f.length + piece_length - 1) / piece_length;
+                std::string layer = pieces_v2.substr(f.offset / piece_length * merkle::HASH_SIZE,
+                                                     file_pieces * merkle::HASH_SIZE);
+                if (file_pieces == 1)
+                {
+                    entry.pieces_root = layer;
+                }
+                else if (file_pieces > 1)
+                {
+                    entry.pieces_root = merkle::root(layer, merkle::next_pow2(file_pieces), pad);
+                    piece_layers[entry.pieces_root] = std::move(layer);
+                }
+                tree.push_back(std::move(entry));
+            }
+            info["meta version"] = 2;
+            info["file tree"] = file_tree(tree);
+        }
+
+        json metainfo{
+            {"created by", "codecrafters-bittorrent"},
+            {"creation date", std::chrono::duration_cast<std::chrono::seconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count()}};
+        metainfo["announce"] = options.announce_url;
+
+        std::string bencoded_info = bencode::encode(info);
+        metainfo["info"] = std::move(info);
+        if (!piece_layers.empty())
+            metainfo["piece layers"] = std::move(piece_layers);
+
+        std::ofstream ofs(output_path, std::ios::binary);
+        if (!ofs)
+            throw std::runtime_error("Failed to open output file: " + output_path);
+        ofs << bencode::encode(metainfo);
+        if (!ofs)
+            throw std::runtime_error("Failed to write torrent: " + output_path);
+
+        std::string info_hash = v1 ? utils::sha1_hash(bencoded_info) : utils::sha256_hash(bencoded_info).substr(0, 20);
+        return utils::to_hex(reinterpret_cast<const unsigned char *>(info_hash.data()), info_hash.size());
+    }
+
+} // namespace torrent
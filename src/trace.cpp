@@ -0,0 +1,153 @@
+#include "trace.h"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace trace {
+
+    static const char MAGIC[8] = {'B', 'T', 'T', 'R', 'A', 'C', 'E', '1'};
+    static constexpr size_t RECORD_HEADER_SIZE = 8 + 4 + 1 + 1 + 1 + 4 + 4;
+    // Largest block accepted in a piece message recorded without its data.
+    static constexpr uint32_t MAX_BLOCK_SIZE = 128 * 1024;
+
+    // Helpers: fixed-width little-endian encoding, independent of host order.
+    static void put_le(std::string& out, uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; ++i) out += static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+
+    static uint64_t get_le(const unsigned char* p, int bytes) {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i) v |= uint64_t(p[i]) << (8 * i);
+        return v;
+    }
+
+    Writer::Writer(const std::string& path, const std::string& info_hash, bool record_payloads)
+        : out_(path, std::ios::binary | std::ios::trunc),
+          record_payloads_(record_payloads),
+          start_(std::chrono::steady_clock::now()) {
+        if (!out_) throw std::runtime_error("Failed to open trace file: " + path);
+        std::string header(MAGIC, sizeof(MAGIC));
+        put_le(header, record_payloads ? FLAG_PAYLOADS : 0, 4);
+        header += info_hash;
+        header.resize(sizeof(MAGIC) + 4 + 20, '\0');
+        out_.write(header.data(), header.size());
+    }
+
+    uint32_t Writer::open_connection(const std::string& address) {
+        Record r;
+        r.kind = Kind::Open;
+        r.data = reinterpret_cast<const uint8_t*>(address.data());
+        r.size = static_cast<uint32_t>(address.size());
+        std::lock_guard<std::mutex> lock(mutex_);
+        r.conn_id = next_conn_id_++;
+        write_record(r);
+        return r.conn_id;
+    }
+
+    void Writer::close_connection(uint32_t conn_id) noexcept {
+        try {
+            Record r;
+            r.kind = Kind::Close;
+            r.conn_id = conn_id;
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!out_) return; // already failed; finish() reports it
+            write_record(r);
+            out_.flush();
+        } catch (...) {
+            // The stream stays failed, so finish() still throws.
+        }
+    }
+
+    void Writer::finish() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out_.flush();
+        if (!out_) throw std::runtime_error("Failed to write trace file");
+    }
+
+    void Writer::frame(uint32_t conn_id, Direction dir, uint8_t msg_id, const std::vector<uint8_t>& payload) {
+        Record r;
+        r.conn_id = conn_id;
+        r.kind = Kind::Frame;
+        r.direction = dir;
+        r.msg_id = msg_id;
+        r.wire_len = payload.size() + 1;
+        size_t keep = payload.size();
+        if (msg_id == 7 && !record_payloads_) keep = std::min<size_t>(keep, 8);
+        r.data = payload.data();
+        r.size = static_cast<uint32_t>(keep);
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_record(r);
+    }
+
+    // Caller holds mutex_.
+    void Writer::write_record(const Record& r) {
+        uint64_t t_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+        std::string buf;
+        buf.reserve(RECORD_HEADER_SIZE + r.size);
+        put_le(buf, t_us, 8);
+        put_le(buf, r.conn_id, 4);
+        put_le(buf, static_cast<uint8_t>(r.kind), 1);
+        put_le(buf, static_cast<uint8_t>(r.direction), 1);
+        put_le(buf, r.msg_id, 1);
+        put_le(buf, r.wire_len, 4);
+        put_le(buf, r.size, 4);
+        buf.append(reinterpret_cast<const char*>(r.data), r.size);
+        out_.write(buf.data(), buf.size());
+        if (!out_) throw std::runtime_error("Failed to write trace record");
+    }
+
+    Trace read_file(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Failed to open trace file: " + path);
+        struct stat st;
+        size_t header_size = sizeof(MAGIC) + 4 + 20;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(header_size)) {
+            close(fd);
+            throw std::runtime_error("Not a trace file: " + path);
+        }
+        size_t size = st.st_size;
+        void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) throw std::runtime_error("Failed to map trace file: " + path);
+
+        Trace t;
+        t.mapping = std::shared_ptr<const void>(m, [size](const void* q) { munmap(const_cast<void*>(q), size); });
+        const auto* p = static_cast<const unsigned char*>(m);
+        if (std::memcmp(p, MAGIC, sizeof(MAGIC)) != 0) throw std::runtime_error("Not a trace file: " + path);
+        t.flags = static_cast<uint32_t>(get_le(p + 8, 4));
+        t.info_hash.assign(reinterpret_cast<const char*>(p + 12), 20);
+
+        size_t pos = header_size;
+        while (pos < size) {
+            if (pos + RECORD_HEADER_SIZE > size) throw std::runtime_error("Truncated trace record");
+            Record r;
+            r.t_us = get_le(p + pos, 8);
+            r.conn_id = static_cast<uint32_t>(get_le(p + pos + 8, 4));
+            r.kind = static_cast<Kind>(p[pos + 12]);
+            r.direction = static_cast<Direction>(p[pos + 13]);
+            r.msg_id = p[pos + 14];
+            r.wire_len = static_cast<uint32_t>(get_le(p + pos + 15, 4));
+            uint32_t stored = static_cast<uint32_t>(get_le(p + pos + 19, 4));
+            pos += RECORD_HEADER_SIZE;
+            if (pos + stored > size) throw std::runtime_error("Truncated trace record");
+            // A frame's wire length counts the id byte and the stored bytes
+            // are the payload after it, except that a piece message in a
+            // trace without payloads keeps only its 8-byte index/begin.
+            bool truncated_piece = r.msg_id == 7 && !(t.flags & FLAG_PAYLOADS) && stored == 8 &&
+                                   r.wire_len > 9 && r.wire_len - 9 <= MAX_BLOCK_SIZE;
+            if (r.kind == Kind::Frame && !truncated_piece && (r.wire_len == 0 || stored != r.wire_len - 1))
+                throw std::runtime_error("Corrupt trace record: frame length " + std::to_string(r.wire_len) +
+                                         " with " + std::to_string(stored) + " stored bytes");
+            r.data = p + pos;
+            r.size = stored;
+            pos += stored;
+            t.records.push_back(std::move(r));
+        }
+        return t;
+    }
+
+} // namespace trace
@@ -1,5 +1,7 @@
 #include "tracker.h"
 #include "bencode.h"
+#include "log.h"
+#include "metrics.h"
 #include <curl/curl.h>
 #include <sstream>
 #include <iomanip>
@@ -7,7 +9,6 @@
 #include <vector>
 #include <cstring>
 #include <arpa/inet.h> // For ntohs
-#include <iostream>
 
 // Helper: URL-encode a string (for info_hash and peer_id)
 static std::string url_encode(const std::string& s) {
@@ -53,14 +54,17 @@ std::vector<Peer> get_peers_from_tracker(
     curl_easy_setopt(curl, CURLOPT_URL, url.str().c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    // A tracker that never answers must not hold a daemon session forever.
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 15L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // timeouts without SIGALRM, safe off the main thread
+    auto start = metrics::Clock::now();
     CURLcode res = curl_easy_perform(curl);
+    metrics::global().tracker_announce_us.record(metrics::micros_since(start));
     curl_easy_cleanup(curl);
 
     if (res != CURLE_OK) throw std::runtime_error("Tracker request failed");
-
-    // Print the raw tracker response for debugging
-std::cout << "Raw tracker response: " << response << std::endl;
-
+    BT_LOG_DEBUG("tracker", "announce to " << announce_url << " returned " << response.size() << " bytes");
 
     // Parse bencoded response
     auto dict = bencode::decode(response);
@@ -84,5 +88,6 @@ std::cout << "Raw tracker response: " << response << std::endl;
 
         peers.push_back(Peer{ip.str(), port_raw});
     }
+    BT_LOG_INFO("tracker", peers.size() << " peers from " << announce_url);
     return peers;
 }
\ No newline at end of file
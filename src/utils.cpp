@@ -3,6 +3,8 @@
 #include <sstream>
 #include <iomanip>
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <stdexcept>
 
 namespace utils {
 
@@ -32,4 +34,50 @@ namespace utils {
         return std::string(reinterpret_cast<char*>(hash), SHA_DIGEST_LENGTH);
     }
 
+    std::string sha256_hash(const std::string& data) {
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(), hash);
+        return std::string(reinterpret_cast<char*>(hash), SHA256_DIGEST_LENGTH);
+    }
+
+    Sha1::Sha1() : ctx_(EVP_MD_CTX_new()) {
+        if (!ctx_ || EVP_DigestInit_ex(ctx_, EVP_sha1(), nullptr) != 1)
+            throw std::runtime_error("Failed to initialise SHA-1");
+    }
+
+    Sha1::~Sha1() {
+        EVP_MD_CTX_free(ctx_);
+    }
+
+    void Sha1::update(const void* data, size_t len) {
+        EVP_DigestUpdate(ctx_, data, len);
+    }
+
+    std::string Sha1::finish() {
+        unsigned char hash[SHA_DIGEST_LENGTH];
+        EVP_DigestFinal_ex(ctx_, hash, nullptr);
+        EVP_DigestInit_ex(ctx_, EVP_sha1(), nullptr);
+        return std::string(reinterpret_cast<char*>(hash), SHA_DIGEST_LENGTH);
+    }
+
+    Sha256::Sha256() : ctx_(EVP_MD_CTX_new()) {
+        if (!ctx_ || EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr) != 1)
+            throw std::runtime_error("Failed to initialise SHA-256");
+    }
+
+    Sha256::~Sha256() {
+        EVP_MD_CTX_free(ctx_);
+    }
+
+    void Sha256::update(const void* data, size_t len) {
+        EVP_DigestUpdate(ctx_, data, len);
+    }
+
+    std::string Sha256::finish() {
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        EVP_DigestFinal_ex(ctx_, hash, nullptr);
+        EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr);
+        return std::string(reinterpret_cast<char*>(hash), SHA256_DIGEST_LENGTH);
+    }
+
 } // namespace utils
\ No newline at end of file